@@ -45,13 +45,31 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <ctype.h>
 #include <fcntl.h>
 #include <time.h>
 #include <math.h>
+#include <ftw.h>
+#include <regex.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <sys/resource.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#if defined HAVE_ZLIB_H
+# include <zlib.h>
+#endif	/* HAVE_ZLIB_H */
+#if defined HAVE_ZSTD_H
+# include <zstd.h>
+#endif	/* HAVE_ZSTD_H */
+#if defined HAVE_LINUX_IO_URING_H
+# include <sys/syscall.h>
+# include <linux/io_uring.h>
+#endif	/* HAVE_LINUX_IO_URING_H */
 #include <assert.h>
+#if defined __SSE2__
+# include <emmintrin.h>
+#endif	/* __SSE2__ */
 #include "nifty.h"
 
 #if defined BUFSIZ
@@ -65,7 +83,16 @@ static long long unsigned int rate = UINT32_MAX / 10U;
 static size_t nfixed;
 /* limit for VLAs */
 static size_t stklmt;
+/* bitmask of ellipses to suppress, the one after the header (LEAD)
+ * and the one before the footer (TRAIL) */
 static unsigned int quietp;
+#define QUIET_LEAD	(1U)
+#define QUIET_TRAIL	(2U)
+/* record delimiter, and the ellipsis terminated by it */
+static const char *dlm = "\n";
+static size_t ndlm = 1U;
+static const char *ell = "...\n";
+static size_t nell = 4U;
 
 
 static void
@@ -91,6 +118,470 @@ min_z(size_t z1, size_t z2)
 	return z1 <= z2 ? z1 : z2;
 }
 
+static const char*
+recchr_mb(const char *s, size_t n)
+{
+/* find the first multi-byte delimiter in S of size N, candidates
+ * are positions where both the first and the last byte of DLM match,
+ * 16 positions at a time, and only those are confirmed by memcmp() */
+	const size_t m = ndlm - 1U;
+	const char *p = s;
+	const char *const ep = s + n;
+
+#if defined __SSE2__
+	const __m128i f = _mm_set1_epi8(dlm[0U]);
+	const __m128i l = _mm_set1_epi8(dlm[m]);
+
+	for (; p + m + 16U <= ep; p += 16U) {
+		const __m128i a = _mm_loadu_si128((const void*)p);
+		const __m128i b = _mm_loadu_si128((const void*)(p + m));
+		unsigned int k = _mm_movemask_epi8(
+			_mm_and_si128(_mm_cmpeq_epi8(a, f),
+				      _mm_cmpeq_epi8(b, l)));
+
+		for (; k; k &= k - 1U) {
+			const char *c = p + __builtin_ctz(k);
+
+			if (!memcmp(c + 1U, dlm + 1U, m - 1U)) {
+				return c + m;
+			}
+		}
+	}
+#endif	/* __SSE2__ */
+	for (; p + m < ep && (p = memchr(p, *dlm, ep - p - m)); p++) {
+		if (!memcmp(p + 1U, dlm + 1U, m)) {
+			return p + m;
+		}
+	}
+	return NULL;
+}
+
+static const char*
+recchr_csv(const char *s, size_t n)
+{
+/* find the first delimiter in S of size N that's not within double
+ * quotes, S must start on a record boundary, i.e. outside quotes
+ * quote parity is the prefix-xor over the bitmask of quotes, done for
+ * 64 bytes at a time, what's carried over is in IN (all ones or 0) */
+	const char *p = s;
+	const char *const ep = s + n;
+	uint64_t in = 0U;
+
+#if defined __SSE2__
+	const __m128i q = _mm_set1_epi8('"');
+	const __m128i d = _mm_set1_epi8(*dlm);
+
+	for (; p + 64U <= ep; p += 64U) {
+		uint64_t mq = 0U, md = 0U;
+
+		for (size_t i = 0U; i < 4U; i++) {
+			const __m128i x =
+				_mm_loadu_si128((const void*)(p + 16U * i));
+			const uint64_t xq = (unsigned int)
+				_mm_movemask_epi8(_mm_cmpeq_epi8(x, q));
+			const uint64_t xd = (unsigned int)
+				_mm_movemask_epi8(_mm_cmpeq_epi8(x, d));
+
+			mq |= xq << (16U * i);
+			md |= xd << (16U * i);
+		}
+		/* bit I is set if there's an odd number of quotes up to I */
+		for (unsigned int i = 1U; i < 64U; i <<= 1U) {
+			mq ^= mq << i;
+		}
+		mq ^= in;
+		if ((md &= ~mq)) {
+			return p + __builtin_ctzll(md);
+		}
+		in = -(mq >> 63U);
+	}
+#endif	/* __SSE2__ */
+	for (int inq = (int)(in & 1U); p < ep; p++) {
+		if (*p == '"') {
+			inq = !inq;
+		} else if (*p == *dlm && !inq) {
+			return p;
+		}
+	}
+	return NULL;
+}
+
+/* record finder for anything but single-byte delimiters */
+static const char*(*recfn)(const char*, size_t);
+/* groups of lines: the line finder, the number of lines per record
+ * or the prefix of a record's first line */
+static const char*(*lnfn)(const char*, size_t);
+static size_t nlpr;
+static const char *rs;
+static size_t nrs;
+/* or a regex to match that line, RS is then its literal prefix */
+static regex_t rsrx;
+static int rsrxp;
+
+static const char*
+recchr_1(const char *s, size_t n)
+{
+	return memchr(s, *dlm, n);
+}
+
+/* fixed-size records */
+static size_t nrsz;
+
+static const char*
+recchr_fix(const char *s, size_t n)
+{
+	return n >= nrsz ? s + nrsz - 1U : NULL;
+}
+
+/* length-prefixed records */
+static enum {
+	LPFX_NONE,
+	LPFX_VARINT,
+	LPFX_U32,
+} lpfx;
+
+static const char*
+recchr_len(const char *s, size_t n)
+{
+/* find the last byte of the record at S, as told by its length prefix */
+	const unsigned char *p = (const unsigned char*)s;
+	uint_fast64_t len = 0U;
+	size_t h = 0U;
+
+	switch (lpfx) {
+	case LPFX_VARINT:
+		for (; h < n && h < 10U; h++) {
+			len |= (uint_fast64_t)(p[h] & 0x7fU) << (7U * h);
+			if (!(p[h] & 0x80U)) {
+				break;
+			}
+		}
+		if (h >= n) {
+			return NULL;
+		} else if (h >= 10U) {
+			/* overlong varint, pass it on as record */
+			return s + 9U;
+		}
+		h++;
+		break;
+	case LPFX_U32:
+		if (n < 4U) {
+			return NULL;
+		}
+		len = (uint_fast64_t)p[0U] << 24U | p[1U] << 16U |
+			p[2U] << 8U | p[3U];
+		h = 4U;
+		break;
+	default:
+		return NULL;
+	}
+	return len <= n - h ? s + h + len - 1U : NULL;
+}
+
+static const char*
+recchr_k(const char *s, size_t n)
+{
+/* find the end of the NLPR-th line in S of size N */
+	const char *const ep = s + n;
+	const char *p = s;
+
+	for (size_t k = nlpr; (p = lnfn(p, ep - p)) && --k; p++);
+	return p;
+}
+
+/* whether the input is exhausted, see read_rs() */
+static int rsend;
+/* bytes that can start a record start regex match, see rx_set() */
+static unsigned char rsset[256U];
+static int rssetp;
+#if !defined REG_STARTEND
+/* line buffer for regexec() */
+static char *rsl;
+static size_t zrsl;
+#endif	/* !REG_STARTEND */
+
+static const char*
+recchr_rs(const char *s, size_t n)
+{
+/* find the end of the line in S of size N that's followed by RS,
+ * or that ends the input */
+	const char *const ep = s + n;
+
+	for (const char *p = s; (p = lnfn(p, ep - p)); p++) {
+		if (p + 1U == ep) {
+			return rsend ? p : NULL;
+		} else if (p + 1U + nrs > ep) {
+			if (!rsend) {
+				return NULL;
+			}
+		} else if (memcmp(p + 1U, rs, nrs)) {
+			/* prefix doesn't match, no need to bother the regex */
+			;
+		} else if (rssetp && !rsset[(unsigned char)p[1U]]) {
+			/* first byte can't start a match, same thing */
+			;
+		} else if (!rsrxp) {
+			return p;
+		} else {
+			const char *const q = p + 1U;
+			const char *eol = lnfn(q, ep - q);
+			regmatch_t m[1U];
+
+			if (eol == NULL && !rsend) {
+				/* need the whole line */
+				return NULL;
+			}
+			m->rm_so = 0;
+			m->rm_eo = eol != NULL ? eol + 1U - ndlm - q : ep - q;
+#if defined REG_STARTEND
+			if (!regexec(&rsrx, q, 1U, m, REG_STARTEND)) {
+				return p;
+			}
+#else  /* !REG_STARTEND */
+			/* hand regexec() a NUL-terminated copy of the line */
+			if ((size_t)m->rm_eo >= zrsl) {
+				const size_t nuz = ((size_t)m->rm_eo / 256U + 1U) * 256U;
+				char *tmp = realloc(rsl, nuz);
+
+				if (UNLIKELY(tmp == NULL)) {
+					errno = 0, error("\
+Error: cannot allocate memory for the record start regex");
+					return NULL;
+				}
+				rsl = tmp;
+				zrsl = nuz;
+			}
+			memcpy(rsl, q, m->rm_eo);
+			rsl[m->rm_eo] = '\0';
+			if (!regexec(&rsrx, rsl, 0U, NULL, 0)) {
+				return p;
+			}
+#endif	/* REG_STARTEND */
+		}
+	}
+	return NULL;
+}
+
+static size_t
+rx_lit(char *restrict tgt, const char *re)
+{
+/* copy the literal prefix of extended regex RE to TGT, return its length */
+	size_t n = 0U;
+
+	if (strchr(re, '|') != NULL) {
+		/* alternatives, all bets are off */
+		return 0U;
+	}
+	for (re += *re == '^'; *re && !strchr("\\.[]()*+?{}^$", *re); re++) {
+		tgt[n++] = *re;
+	}
+	/* the last literal might be optional or repeated */
+	n -= n && *re && strchr("*?{", *re);
+	return n;
+}
+
+static int
+rx_set(unsigned char *restrict set, const char *re)
+{
+/* mark the bytes in SET that can start a match of extended regex RE
+ * if it starts with a bracket expression, return 0 if it doesn't */
+	static const struct {
+		const char *nm;
+		int(*fn)(int);
+	} cls[] = {
+		{"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank},
+		{"cntrl", iscntrl}, {"digit", isdigit}, {"graph", isgraph},
+		{"lower", islower}, {"print", isprint}, {"punct", ispunct},
+		{"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit},
+	};
+	const char *p = re + (*re == '^');
+	const char *q;
+	int neg;
+
+	if (strchr(re, '|') != NULL || *p++ != '[') {
+		return 0;
+	}
+	memset(set, 0, 256U);
+	p += neg = *p == '^';
+	for (q = p; *q != ']' || q == p; q++) {
+		if (!*q) {
+			return 0;
+		} else if (*q == '[' && (q[1U] == '=' || q[1U] == '.')) {
+			/* equivalence classes and collating symbols, meh */
+			return 0;
+		} else if (*q == '[' && q[1U] == ':') {
+			const char *e = strstr(q + 2U, ":]");
+			size_t k = 0U;
+
+			for (; e != NULL && k < countof(cls); k++) {
+				const size_t z = e - (q + 2U);
+
+				if (!strncmp(q + 2U, cls[k].nm, z) && !cls[k].nm[z]) {
+					break;
+				}
+			}
+			if (e == NULL || k >= countof(cls)) {
+				return 0;
+			}
+			for (int c = 0; c < 256; c++) {
+				set[c] |= !!cls[k].fn(c);
+			}
+			q = e + 1U;
+		} else if (q[1U] == '-' && q[2U] && q[2U] != ']') {
+			for (int c = (unsigned char)*q;
+			     c <= (unsigned char)q[2U]; c++) {
+				set[c] = 1U;
+			}
+			q += 2U;
+		} else {
+			set[(unsigned char)*q] = 1U;
+		}
+	}
+	/* the bracket expression might be optional */
+	if (q[1U] == '*' || q[1U] == '?' ||
+	    (q[1U] == '{' && (!isdigit(q[2U]) || q[2U] == '0'))) {
+		return 0;
+	}
+	for (size_t c = 0U; neg && c < 256U; c++) {
+		set[c] ^= 1U;
+	}
+	return 1;
+}
+
+static inline const char*
+recchr(const char *s, size_t n)
+{
+/* like memchr() for the record delimiter, returns its last byte */
+	if (LIKELY(recfn == NULL)) {
+		return memchr(s, *dlm, n);
+	}
+	return recfn(s, n);
+}
+
+static inline size_t
+recdlm(const char *s, size_t n)
+{
+/* return the size of record S of size N without its delimiter */
+	return n >= ndlm && !memcmp(s + n - ndlm, dlm, ndlm) ? n - ndlm : n;
+}
+
+/* field separator, fields are counted from 1 */
+static char fs = '\t';
+
+static const char*
+fld(const char *s, size_t *n, size_t k)
+{
+/* return the K-th field of S of size N and update N to its size,
+ * missing fields are empty */
+	const char *const ep = s + *n;
+	const char *p;
+
+	for (; --k && (p = memchr(s, fs, ep - s)); s = p + 1U);
+	if (k) {
+		*n = 0U;
+		return ep;
+	} else if ((p = memchr(s, fs, ep - s)) == NULL) {
+		p = ep;
+	}
+	*n = p - s;
+	return s;
+}
+
+static double
+fldnum(const char *s, size_t n, size_t k)
+{
+/* return the K-th field of S of size N as number, NAN if it's none */
+	static const uint64_t p10[] = {
+		1U, 10U, 100U, 1000U, 10000U, 100000U, 1000000U,
+		10000000U, 100000000U, 1000000000U, 10000000000U,
+		100000000000U, 1000000000000U, 10000000000000U,
+		100000000000000U, 1000000000000000U,
+	};
+	char b[64U];
+	char *on;
+	double x;
+
+	s = fld(s, &n, k);
+	if (!n || n >= sizeof(b)) {
+		return NAN;
+	}
+	/* plain decimals of up to 15 digits are exact this way */
+	with (uint64_t m = 0U) {
+		size_t i = 0U, f = 0U;
+
+		for (; i < n && (unsigned char)(s[i] ^ '0') < 10U; i++) {
+			m = m * 10U + (s[i] ^ '0');
+		}
+		if (i < n && s[i] == '.') {
+			for (f = ++i; i < n &&
+				     (unsigned char)(s[i] ^ '0') < 10U; i++) {
+				m = m * 10U + (s[i] ^ '0');
+			}
+			f = i - f;
+		}
+		if (i == n && n > (f > 0U) && i - (f > 0U) <= 15U) {
+			return (double)m / (double)p10[f];
+		}
+	}
+	memcpy(b, s, n);
+	b[n] = '\0';
+	x = strtod(b, &on);
+	return *on ? NAN : x;
+}
+
+static inline uint64_t
+mum64(uint64_t x, uint64_t y)
+{
+/* fold the 128-bit product of X and Y */
+#if defined __SIZEOF_INT128__
+	const __uint128_t r = (__uint128_t)x * y;
+
+	return (uint64_t)r ^ (uint64_t)(r >> 64U);
+#else  /* !__SIZEOF_INT128__ */
+	const uint64_t xl = x & 0xffffffffU, xh = x >> 32U;
+	const uint64_t yl = y & 0xffffffffU, yh = y >> 32U;
+	const uint64_t ll = xl * yl, lh = xl * yh, hl = xh * yl, hh = xh * yh;
+	const uint64_t m = (ll >> 32U) + (lh & 0xffffffffU) + hl;
+
+	return (ll & 0xffffffffU | m << 32U) ^
+		(hh + (lh >> 32U) + (m >> 32U));
+#endif	/* __SIZEOF_INT128__ */
+}
+
+static inline uint64_t
+le64(const unsigned char *b)
+{
+	uint64_t r = 0U;
+
+	for (size_t i = 8U; i-- > 0U; r = r << 8U | b[i]);
+	return r;
+}
+
+static uint64_t
+hash64(const char *s, size_t n)
+{
+/* hash S of size N, 16 bytes per multiplication in the spirit of
+ * wyhash, the result is the same on every machine and in every run */
+	static const uint64_t p[] = {
+		0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+		0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL,
+	};
+	const unsigned char *b = (const unsigned char*)s;
+	uint64_t h = p[0U] ^ n;
+	size_t i = 0U;
+
+	for (; i + 16U <= n; i += 16U) {
+		h = mum64(le64(b + i) ^ p[1U] ^ h, le64(b + i + 8U) ^ p[2U]);
+	}
+	if (i < n) {
+		unsigned char t[16U] = {0};
+
+		memcpy(t, b + i, n - i);
+		h = mum64(le64(t) ^ p[1U] ^ h, le64(t + 8U) ^ p[2U]);
+	}
+	return mum64(h ^ p[3U], n ^ p[0U]);
+}
+
 
 static uint64_t g32;
 
@@ -138,6 +629,51 @@ runifu32b(uint32_t bound)
     }
 }
 
+static uint64_t
+runifu64(void)
+{
+	uint64_t hi = runifu32();
+	return hi << 32U | runifu32();
+}
+
+static inline double
+runifd_s(uint64_t *s)
+{
+/* uniform on the open interval (0, 1), off random state S */
+	const uint64_t hi = pcg32_xsh_rr(s);
+
+	return ((double)((hi << 32U | pcg32_xsh_rr(s)) >> 11U) + 0x1.p-1) *
+		0x1.p-53;
+}
+
+static inline double
+runifd(void)
+{
+	return runifd_s(&g32);
+}
+
+static int
+u64cmp(const void *x, const void *y)
+{
+	const uint64_t a = *(const uint64_t*)x, b = *(const uint64_t*)y;
+	return (a > b) - (a < b);
+}
+
+static inline int
+u64set_add(uint64_t *set, size_t zset, uint64_t y)
+{
+/* add non-zero Y to the open-addressed SET of size ZSET, a power of 2,
+ * return whether it's new */
+	size_t k = (y * 0x9e3779b97f4a7c15ULL) >> (64U - __builtin_ctzll(zset));
+
+	for (; set[k] && set[k] != y; k = (k + 1U) & (zset - 1U));
+	if (set[k]) {
+		return 0;
+	}
+	set[k] = y;
+	return 1;
+}
+
 static unsigned int
 rexp32(unsigned int n, unsigned int d)
 {
@@ -147,1235 +683,5530 @@ rexp32(unsigned int n, unsigned int d)
 }
 
 
-/* buffer */
-static char *buf;
-static size_t zbuf;
-/* reservoir */
-static char *rsv;
-static size_t zrsv;
-/* compactify */
-static uint8_t *comp;
-static size_t *idir;
+/* input
+ * samplers pull their data through RD, normally that's just read()
+ * but in --union mode it walks a chain of files */
+static ssize_t(*rd)(int, void*, size_t) = read;
+
+/* batch slots, in batch mode files are slurped (in part) into memory
+ * before the sampler sees them, RD then serves SLB first and continues
+ * reading from SLFD if there's more to the file */
+#define NBATCH	(128U)
+#define ZSLOT	(BUFSIZ / 4U)
+static struct {
+	const char *fn;
+	/* results of the openat() and read() */
+	int ores;
+	int rres;
+	unsigned int npend;
+} slots[2U * NBATCH];
+static char *slbuf;
+static const char *slb;
+static size_t sln;
+static int slfd = -1;
+
+static ssize_t
+read_slot(int UNUSED(fd), void *b, size_t z)
+{
+	if (sln) {
+		const size_t n = min_z(z, sln);
+
+		memcpy(b, slb, n);
+		slb += n;
+		sln -= n;
+		return n;
+	} else if (slfd >= 0) {
+		return read(slfd, b, z);
+	}
+	return 0;
+}
+
+#if defined HAVE_STRUCT_IO_URING_SQE_FILE_INDEX
+/* raw io_uring, we don't want to depend on liburing */
+static struct {
+	int fd;
+	unsigned int *sqhd;
+	unsigned int *sqtl;
+	unsigned int *sqarr;
+	unsigned int sqmsk;
+	unsigned int *cqhd;
+	unsigned int *cqtl;
+	unsigned int cqmsk;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	/* local tail and number of unsubmitted sqes */
+	unsigned int tl;
+	unsigned int nsub;
+	void *sqr;
+	size_t zsqr;
+	void *cqr;
+	size_t zcqr;
+	size_t zsqes;
+} uring = {.fd = -1};
 
 static void
-compactify(size_t *restrict off, const size_t m, const size_t n)
+uring_fini(void)
 {
-/* helper for reservoir sampling
- * compact M lines into N whose offsets are in OFF */
-	size_t o = 0U;
-
-	if (UNLIKELY(comp == NULL)) {
-		comp = malloc(m * sizeof(*comp));
-		if (UNLIKELY(comp == NULL)) {
-			return;
-		}
-		idir = malloc(n * sizeof(*idir));
-		if (UNLIKELY(idir == NULL)) {
-			free(comp);
-			comp = NULL;
-			return;
-		}
+	if (uring.fd < 0) {
+		return;
+	}
+	if (uring.sqes != NULL && uring.sqes != MAP_FAILED) {
+		munmap(uring.sqes, uring.zsqes);
+	}
+	if (uring.cqr != NULL && uring.cqr != MAP_FAILED &&
+	    uring.cqr != uring.sqr) {
+		munmap(uring.cqr, uring.zcqr);
+	}
+	if (uring.sqr != NULL && uring.sqr != MAP_FAILED) {
+		munmap(uring.sqr, uring.zsqr);
 	}
+	close(uring.fd);
+	uring.fd = -1;
+	return;
+}
 
-	/* prep compactifier, this is a radix sort */
-	memset(comp, 0, m * sizeof(*comp));
-	/* prep IDIR buffer */
-	for (size_t i = 0U; i < n; i++) {
-		idir[i] = i;
+static int
+uring_init(unsigned int n, unsigned int nfiles)
+{
+	struct io_uring_params p;
+	int fds[nfiles];
+	int fd;
+
+	memset(&p, 0, sizeof(p));
+	if ((fd = syscall(__NR_io_uring_setup, n, &p)) < 0) {
+		return -1;
 	}
-	for (size_t i = n; i < m; i++) {
-		idir[runifu32b(n)] = i;
+	uring.fd = fd;
+	uring.zsqr = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	uring.zcqr = p.cq_off.cqes + p.cq_entries * sizeof(*uring.cqes);
+	uring.zsqes = p.sq_entries * sizeof(*uring.sqes);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		uring.zsqr = uring.zcqr =
+			uring.zsqr > uring.zcqr ? uring.zsqr : uring.zcqr;
 	}
-	/* now sort him */
-	for (size_t i = 0U; i < n; i++) {
-		comp[idir[i]] = 1U;
+	uring.sqr = mmap(NULL, uring.zsqr, PROT_READ | PROT_WRITE,
+			 MAP_SHARED, fd, IORING_OFF_SQ_RING);
+	if (UNLIKELY(uring.sqr == MAP_FAILED)) {
+		goto fail;
+	}
+	uring.cqr = p.features & IORING_FEAT_SINGLE_MMAP
+		? uring.sqr
+		: mmap(NULL, uring.zcqr, PROT_READ | PROT_WRITE,
+		       MAP_SHARED, fd, IORING_OFF_CQ_RING);
+	if (UNLIKELY(uring.cqr == MAP_FAILED)) {
+		goto fail;
+	}
+	uring.sqes = mmap(NULL, uring.zsqes, PROT_READ | PROT_WRITE,
+			  MAP_SHARED, fd, IORING_OFF_SQES);
+	if (UNLIKELY(uring.sqes == MAP_FAILED)) {
+		goto fail;
+	}
+	uring.sqhd = (unsigned int*)((char*)uring.sqr + p.sq_off.head);
+	uring.sqtl = (unsigned int*)((char*)uring.sqr + p.sq_off.tail);
+	uring.sqarr = (unsigned int*)((char*)uring.sqr + p.sq_off.array);
+	uring.sqmsk = *(unsigned int*)((char*)uring.sqr + p.sq_off.ring_mask);
+	uring.cqhd = (unsigned int*)((char*)uring.cqr + p.cq_off.head);
+	uring.cqtl = (unsigned int*)((char*)uring.cqr + p.cq_off.tail);
+	uring.cqmsk = *(unsigned int*)((char*)uring.cqr + p.cq_off.ring_mask);
+	uring.cqes = (void*)((char*)uring.cqr + p.cq_off.cqes);
+	uring.tl = *uring.sqtl;
+
+	/* sparse table of direct descriptors, openat() goes in there */
+	for (size_t i = 0U; i < nfiles; i++) {
+		fds[i] = -1;
 	}
+	if (syscall(__NR_io_uring_register, fd,
+		    IORING_REGISTER_FILES, fds, nfiles) < 0) {
+		goto fail;
+	}
+	return 0;
 
-	/* ... now move them lines
-	 * we calculate streaks of lines and move them in bulk */
-	for (size_t i = 0U, beg = 0U, end; beg < m; beg = end + 1U) {
-		size_t len;
+fail:
+	uring_fini();
+	return -1;
+}
 
-		/* find first line to move, COMP[] is guaranteed to have
-		 * N matches */
-		for (; !comp[beg]; beg++);
-		for (end = beg + 1U; end < m && comp[end]; end++);
+static struct io_uring_sqe*
+uring_sqe(void)
+{
+/* callers must make sure there's enough room in the ring */
+	const unsigned int i = uring.tl++ & uring.sqmsk;
+	struct io_uring_sqe *sqe = uring.sqes + i;
+
+	memset(sqe, 0, sizeof(*sqe));
+	uring.sqarr[i] = i;
+	uring.nsub++;
+	return sqe;
+}
 
-		memmove(rsv + o, rsv + off[beg], len = off[end] - off[beg]);
+static int
+uring_enter(unsigned int wait)
+{
+	const unsigned int nsub = uring.nsub;
 
-		/* resolve into lines again */
-		for (size_t j = beg, bof = off[beg]; j < end; j++) {
-			off[i++] = o + off[j] - bof;
+	__atomic_store_n(uring.sqtl, uring.tl, __ATOMIC_RELEASE);
+	uring.nsub = 0U;
+	if (syscall(__NR_io_uring_enter, uring.fd, nsub, wait,
+		    wait ? IORING_ENTER_GETEVENTS : 0U, NULL, 0) < 0 &&
+	    errno != EINTR) {
+		return -1;
+	}
+	/* reap whatever's there, slot and op are in the user data */
+	for (unsigned int hd = *uring.cqhd,
+		     tl = __atomic_load_n(uring.cqtl, __ATOMIC_ACQUIRE);
+	     hd != tl; hd++) {
+		const struct io_uring_cqe *cqe = uring.cqes + (hd & uring.cqmsk);
+		const size_t s = cqe->user_data >> 2U;
+
+		switch (cqe->user_data & 0x3U) {
+		case 0U:
+			slots[s].ores = cqe->res;
+			break;
+		case 1U:
+			slots[s].rres = cqe->res;
+			break;
+		default:
+			break;
 		}
-		o += len;
+		slots[s].npend--;
+		__atomic_store_n(uring.cqhd, hd + 1U, __ATOMIC_RELEASE);
 	}
-	off[n] = o;
-	return;
+	return 0;
 }
 
 static int
-sample_0(int fd)
+uring_drain(void)
 {
-	(void)fd;
+/* wait for all chains in flight to finish, return -1 if they can't */
+	for (size_t s = 0U; s < countof(slots); s++) {
+		while (slots[s].npend) {
+			/* resubmit what the kernel hasn't picked up */
+			uring.nsub = uring.tl -
+				__atomic_load_n(uring.sqhd, __ATOMIC_ACQUIRE);
+			if (uring_enter(1U) < 0) {
+				return -1;
+			}
+		}
+	}
 	return 0;
 }
 
-static int
-sample_gen(int fd)
+static void
+uring_slurp(size_t s, const char *fn)
 {
-/* generic sampler */
-	/* number of lines read so far */
-	size_t nfln = 0U;
-	/* number of output lines so far */
-	size_t noln = 0U;
-	/* fill of BUF, also used as offset of end-of-header in HDR mode */
-	size_t nbuf = 0U;
-	/* index into BUF to the beginning of the last unprocessed line */
-	size_t ibuf = 0U;
-	/* number of octets read per read() */
-	ssize_t nrd;
-	/* offsets to footer */
-	size_t _last[stklmt];
-	size_t *last = _last;
-#define LAST(x)		last[(x) % (nfooter + 1U)]
-#define FIRST(x)	((x) > nfooter ? LAST(x) : 0U)
-	/* 3 major states, HEAD BEEF/CAKE and TAIL */
+/* open FN into direct descriptor S, read ZSLOT bytes into slot S,
+ * then close it again, all of it in one linked chain */
+	struct io_uring_sqe *sqe;
+
+	slots[s].fn = fn;
+	slots[s].ores = slots[s].rres = 0;
+	slots[s].npend = 3U;
+
+	sqe = uring_sqe();
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uintptr_t)fn;
+	sqe->open_flags = O_RDONLY;
+	sqe->file_index = s + 1U;
+	sqe->flags = IOSQE_IO_HARDLINK;
+	sqe->user_data = s << 2U | 0U;
+
+	sqe = uring_sqe();
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = s;
+	sqe->addr = (uintptr_t)(slbuf + s * ZSLOT);
+	sqe->len = ZSLOT;
+	sqe->off = 0U;
+	/* short reads are to be expected, so use hard links */
+	sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+	sqe->user_data = s << 2U | 1U;
+
+	sqe = uring_sqe();
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->file_index = s + 1U;
+	sqe->user_data = s << 2U | 2U;
+	return;
+}
+#endif	/* HAVE_STRUCT_IO_URING_SQE_FILE_INDEX */
+
+#if defined HAVE_ZLIB_H || defined HAVE_ZSTD_H
+/* decompression
+ * a decoder thread fills a ring of blocks which RD drains in order,
+ * for BGZF the decoder just cuts the input into blocks and leaves the
+ * inflating to a couple of worker threads */
+#define NDQ	(64U)
+static struct {
+	/* compressed input, BGZF only */
+	unsigned char *ib;
+	size_t in;
+	/* decompressed output */
+	char *ob;
+	size_t on;
 	enum {
-		EVAL,
-		HEAD,
-		BEEF,
-		TAIL,
-		CAKE,
-	} state = EVAL;
+		DQ_FREE,
+		DQ_FILL,
+		DQ_BUSY,
+		DQ_DONE,
+	} st;
+} dq[NDQ];
+/* consumer position, offset into its block, and producer position */
+static size_t dqrd;
+static size_t dqoff;
+static size_t dqwr;
+/* producer finished (1), or failed (-1), and consumer quit */
+static int dqeof;
+static int dqerr;
+static int dqquit;
+static pthread_mutex_t dqmtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dqcnd = PTHREAD_COND_INITIALIZER;
+/* the source and what's been read of it to detect the codec */
+static int dqfd;
+static const char *dqpfx;
+static size_t dqnpfx;
+static pthread_t dqthr[1U + 16U];
+static size_t ndqthr;
+static unsigned int nthr = 1U;
+
+enum {
+	CODEC_NONE,
+	CODEC_GZ,
+	CODEC_BGZF,
+	CODEC_ZST,
+};
 
-	with (char *tmp = realloc(buf, BUFSIZ)) {
-		if (UNLIKELY(tmp == NULL)) {
-			/* just bugger off */
-			return -1;
-		}
-		/* otherwise swap ptrs */
-		buf = tmp;
-		zbuf = BUFSIZ;
+static int
+dec_magic(const unsigned char *b, size_t n)
+{
+#if defined HAVE_ZLIB_H
+	if (n >= 18U && b[0U] == 0x1fU && b[1U] == 0x8bU &&
+	    b[2U] == 8U && b[3U] & 4U &&
+	    b[12U] == 'B' && b[13U] == 'C' && b[14U] == 2U && !b[15U]) {
+		return CODEC_BGZF;
+	} else if (n >= 3U && b[0U] == 0x1fU && b[1U] == 0x8bU && b[2U] == 8U) {
+		return CODEC_GZ;
 	}
+#endif	/* HAVE_ZLIB_H */
+#if defined HAVE_ZSTD_H
+	if (n >= 4U && b[0U] == 0x28U && b[1U] == 0xb5U &&
+	    b[2U] == 0x2fU && b[3U] == 0xfdU) {
+		return CODEC_ZST;
+	}
+#endif	/* HAVE_ZSTD_H */
+	(void)b;
+	(void)n;
+	return CODEC_NONE;
+}
 
-	if (nfooter >= countof(_last)) {
-		/* better do it with heap space */
-		last = malloc((nfooter + 1U) * sizeof(*last));
+static ssize_t
+dec_src(void *b, size_t z)
+{
+/* read from the source, what's been used for detection first */
+	if (dqnpfx) {
+		const size_t n = min_z(z, dqnpfx);
+
+		memcpy(b, dqpfx, n);
+		dqpfx += n;
+		dqnpfx -= n;
+		return n;
 	}
+	return read(dqfd, b, z);
+}
 
-	/* deal with header */
-	while ((nrd = read(fd, buf + nbuf, zbuf - nbuf)) > 0) {
-		/* calc next round's NBUF already */
-		nbuf += nrd;
+static size_t
+dec_srcn(void *b, size_t z)
+{
+/* like dec_src() but insist on Z bytes */
+	size_t n = 0U;
 
-		switch (state) {
-		case EVAL:
-			if (rate > UINT32_MAX) {
-				/* oh they want everything printed */
-				fwrite(buf, sizeof(*buf), nrd, stdout);
-				nbuf = 0U;
-				break;
-			} else if (!nfooter && !nheader) {
-				goto cake;
-			} else if (!nheader) {
-				goto tail;
-			}
-			/* otherwise let HEAD state decide */
-			state = HEAD;
-		case HEAD:
-			for (const char *x;
-			     (x = memchr(buf + ibuf, '\n', nbuf - ibuf));) {
-				const size_t o = ibuf;
+	for (ssize_t nrd;
+	     n < z && (nrd = dec_src((char*)b + n, z - n)) > 0; n += nrd);
+	return n;
+}
 
-				ibuf = ++x - buf;
-				fwrite(buf + o, sizeof(*buf), ibuf - o, stdout);
-				noln++;
+static size_t
+dec_claim(void)
+{
+/* wait for the next free block, return NDQ if we're to quit */
+	size_t i;
 
-				if (++nfln >= nheader) {
-					if (UNLIKELY(!nfooter && !rate)) {
-						/* that's it */
-						return 0;
-					} else if (!nfooter) {
-						goto cake;
-					}
-					/* otherwise the most generic mode */
-					goto tail;
-				}
-			}
-			goto wrap;
+	pthread_mutex_lock(&dqmtx);
+	while (dq[i = dqwr % NDQ].st != DQ_FREE && !dqquit) {
+		pthread_cond_wait(&dqcnd, &dqmtx);
+	}
+	i = dqquit ? NDQ : i;
+	pthread_mutex_unlock(&dqmtx);
+	return i;
+}
 
-		cake:
-			if (!quietp) {
-				fwrite("...\n", 1, 4U, stdout);
-			}
-			state = CAKE;
-		case CAKE:
-			/* CAKE is the mode where we don't track tail lines */
-			for (const char *x;
-			     (x = memchr(buf + ibuf, '\n', nbuf - ibuf));) {
-				const size_t o = ibuf;
+static void
+dec_publish(size_t i, int st, int eof)
+{
+	pthread_mutex_lock(&dqmtx);
+	if (i < NDQ) {
+		dq[i].st = st;
+		dqwr++;
+	}
+	if (eof) {
+		dqeof = eof;
+	}
+	pthread_cond_broadcast(&dqcnd);
+	pthread_mutex_unlock(&dqmtx);
+	return;
+}
 
-				ibuf = ++x - buf;
-				nfln++;
+#if defined HAVE_ZLIB_H
+static void*
+dec_gz(void *UNUSED(arg))
+{
+/* sequential inflater for ordinary gzip streams */
+	unsigned char ib[BUFSIZ];
+	z_stream z;
+	/* whether we're in the middle of a member */
+	int midp = 0;
+	int eof = 0;
+
+	memset(&z, 0, sizeof(z));
+	if (inflateInit2(&z, 15 + 32) != Z_OK) {
+		dec_publish(NDQ, 0, -1);
+		return NULL;
+	}
+	while (!eof) {
+		const size_t i = dec_claim();
+		int ret;
 
-				/* sample */
-				if (runifu32() < rate) {
-					fwrite(buf + o, sizeof(*buf),
-					       ibuf - o, stdout);
-					noln++;
+		if (i >= NDQ) {
+			break;
+		}
+		z.next_out = (unsigned char*)dq[i].ob;
+		z.avail_out = BUFSIZ;
+		while (z.avail_out) {
+			if (!z.avail_in) {
+				const ssize_t nrd = dec_src(ib, sizeof(ib));
+
+				if (nrd <= 0) {
+					/* truncated members are errors */
+					eof = nrd < 0 || midp ? -1 : 1;
+					break;
 				}
+				z.next_in = ib;
+				z.avail_in = nrd;
 			}
-			goto wrap;
-
-		wrap:
-			if (LIKELY(nbuf < zbuf / 2U)) {
-				/* we've got enough buffer, use, him */
+			midp = 1;
+			switch ((ret = inflate(&z, Z_NO_FLUSH))) {
+			case Z_STREAM_END:
+				/* could be a concatenation of members */
+				inflateReset(&z);
+				midp = 0;
+			case Z_OK:
+			case Z_BUF_ERROR:
+				continue;
+			default:
+				eof = -1;
 				break;
-			} else if (UNLIKELY(!ibuf)) {
-				/* great, try a resize */
-				const size_t nuz = zbuf * 2U;
-				char *tmp = realloc(buf, nuz);
-
-				if (UNLIKELY(tmp == NULL)) {
-					return -1;
-				}
-				/* otherwise assign and retry */
-				buf = tmp;
-				zbuf = nuz;
-			} else if (LIKELY(ibuf < nbuf)) {
-				memmove(buf, buf + ibuf, nbuf - ibuf);
 			}
-			nbuf -= ibuf;
-			ibuf = 0U;
 			break;
+		}
+		dq[i].on = BUFSIZ - z.avail_out;
+		dec_publish(i, DQ_DONE, eof);
+	}
+	inflateEnd(&z);
+	return NULL;
+}
 
-		tail:
-			state = TAIL;
-		case TAIL:
-			for (const char *x;
-			     (x = memchr(buf + ibuf, '\n', nbuf - ibuf));) {
-				/* keep track of footers */
-				LAST(nfln - nheader) = ibuf;
-				ibuf = ++x - buf;
+static void*
+dec_bgzf(void *UNUSED(arg))
+{
+/* cut BGZF input into blocks, the BSIZE field tells us where */
+	int eof = 0;
 
-				if (++nfln > nheader + nfooter && rate) {
-					goto beef;
-				}
-			}
-			goto over;
+	while (!eof) {
+		const size_t i = dec_claim();
+		unsigned char *b;
+		size_t bsz;
 
-		beef:
-			if (!quietp) {
-				fwrite("...\n", 1, 4U, stdout);
-			}
-			state = BEEF;
-			/* we need one more sample step because the
-			 * condition above that got us here goes one
-			 * step further than it should, lest we print
-			 * the ellipsis when there's exactly
-			 * nheader + nfoooter lines in the buffer */
-			goto sample;
+		if (i >= NDQ) {
+			break;
+		}
+		b = dq[i].ib;
+		if (!(dq[i].in = dec_srcn(b, 18U))) {
+			/* that's it */
+			dec_publish(NDQ, 0, 1);
+			break;
+		} else if (dq[i].in < 18U || b[0U] != 0x1fU || b[1U] != 0x8bU ||
+			   b[12U] != 'B' || b[13U] != 'C') {
+			dec_publish(NDQ, 0, -1);
+			break;
+		}
+		bsz = (b[16U] | b[17U] << 8U) + 1U;
+		if (dec_srcn(b + 18U, bsz - 18U) < bsz - 18U) {
+			dec_publish(NDQ, 0, -1);
+			break;
+		}
+		dq[i].in = bsz;
+		dec_publish(i, DQ_FILL, 0);
+	}
+	return NULL;
+}
 
-		case BEEF:
-			for (const char *x;
-			     (x = memchr(buf + ibuf, '\n', nbuf - ibuf));) {
-				/* keep track of footers */
-				LAST(nfln - nheader) = ibuf;
-				ibuf = ++x - buf;
+static ssize_t
+bgzf_inflate(z_stream *z, const unsigned char *b, size_t n, char *ob)
+{
+/* inflate BGZF block B of size N into OB, return its size */
+	size_t xlen, isz;
+	uint32_t crc;
 
-				nfln++;
+	/* 10 bytes header, XLEN, the extra field, deflate data,
+	 * then CRC32 and ISIZE */
+	if (UNLIKELY(n < 12U || 12U + (xlen = b[10U] | b[11U] << 8U) + 8U > n)) {
+		return -1;
+	}
+	isz = b[n - 4U] | b[n - 3U] << 8U |
+		b[n - 2U] << 16U | (size_t)b[n - 1U] << 24U;
+	crc = (uint32_t)b[n - 8U] | (uint32_t)b[n - 7U] << 8U |
+		(uint32_t)b[n - 6U] << 16U | (uint32_t)b[n - 5U] << 24U;
+	if (UNLIKELY(isz > BUFSIZ)) {
+		return -1;
+	}
+	inflateReset(z);
+	z->next_in = deconst(b + 12U + xlen);
+	z->avail_in = n - 12U - xlen - 8U;
+	z->next_out = (unsigned char*)ob;
+	z->avail_out = BUFSIZ;
+	if (inflate(z, Z_FINISH) != Z_STREAM_END || z->total_out != isz ||
+	    crc32(0L, (unsigned char*)ob, isz) != crc) {
+		return -1;
+	}
+	return isz;
+}
 
-			sample:
-				/* sample */
-				if (runifu32() < rate) {
-					const size_t this =
-						LAST(nfln - nheader + 0U);
-					const size_t next =
-						LAST(nfln - nheader + 1U);
-
-					fwrite(buf + this, sizeof(*buf),
-					       next - this, stdout);
-					noln++;
+static void*
+dec_bgzf_wk(void *UNUSED(arg))
+{
+/* inflate BGZF blocks in whatever order they come */
+	z_stream z;
+
+	memset(&z, 0, sizeof(z));
+	if (inflateInit2(&z, -15) != Z_OK) {
+		dec_publish(NDQ, 0, -1);
+		return NULL;
+	}
+	for (;;) {
+		size_t i = NDQ;
+		ssize_t isz;
+		int ok;
+
+		pthread_mutex_lock(&dqmtx);
+		while (!dqquit) {
+			for (size_t j = dqrd; j < dqwr; j++) {
+				if (dq[j % NDQ].st == DQ_FILL) {
+					i = j % NDQ;
+					break;
 				}
 			}
-			goto over;
+			if (i < NDQ || dqeof) {
+				break;
+			}
+			pthread_cond_wait(&dqcnd, &dqmtx);
+		}
+		if (i < NDQ) {
+			dq[i].st = DQ_BUSY;
+		}
+		pthread_mutex_unlock(&dqmtx);
 
-		over:
-			/* beef buffer overrun handling */
-			with (const size_t frst = FIRST(nfln - nheader)) {
-				if (LIKELY(nbuf < zbuf / 2U)) {
-					/* just read more stuff */
-					break;
-				} else if (UNLIKELY(!frst || frst == ibuf)) {
-					/* resize and retry */
-					const size_t nuz = zbuf * 2U;
-					char *tmp = realloc(buf, nuz);
+		if (i >= NDQ) {
+			break;
+		}
+		isz = bgzf_inflate(&z, dq[i].ib, dq[i].in, dq[i].ob);
+		ok = isz >= 0;
+
+		pthread_mutex_lock(&dqmtx);
+		dq[i].on = ok ? isz : 0U;
+		dq[i].st = DQ_DONE;
+		dqerr = ok ? dqerr : -1;
+		pthread_cond_broadcast(&dqcnd);
+		pthread_mutex_unlock(&dqmtx);
+	}
+	inflateEnd(&z);
+	return NULL;
+}
+#endif	/* HAVE_ZLIB_H */
 
-					if (UNLIKELY(tmp == NULL)) {
-						return -1;
-					}
-					/* otherwise assign and retry */
-					buf = tmp;
-					zbuf = nuz;
+#if defined HAVE_ZSTD_H
+static void*
+dec_zst(void *UNUSED(arg))
+{
+/* sequential zstd decoder, does multiple frames too */
+	unsigned char ib[BUFSIZ];
+	ZSTD_DCtx *z;
+	ZSTD_inBuffer zi = {ib, 0U, 0U};
+	/* hint from the decoder, 0 means frame complete */
+	size_t hint = 0U;
+	int eof = 0;
+
+	if ((z = ZSTD_createDCtx()) == NULL) {
+		dec_publish(NDQ, 0, -1);
+		return NULL;
+	}
+	while (!eof) {
+		const size_t i = dec_claim();
+		ZSTD_outBuffer zo;
+
+		if (i >= NDQ) {
+			break;
+		}
+		zo = (ZSTD_outBuffer){dq[i].ob, BUFSIZ, 0U};
+		while (zo.pos < zo.size) {
+			if (zi.pos >= zi.size) {
+				const ssize_t nrd = dec_src(ib, sizeof(ib));
+
+				if (nrd <= 0) {
+					/* truncated frames are errors */
+					eof = nrd < 0 || hint ? -1 : 1;
 					break;
 				}
-				memmove(buf, buf + frst, nbuf - frst);
-				for (size_t i = 0U,
-					     n = min_z(nfooter + 1U,
-						       nfln - nheader);
-				     i < n; i++) {
-					last[i] -= frst;
-				}
-				nbuf -= frst;
-				ibuf -= frst;
+				zi.size = nrd;
+				zi.pos = 0U;
+			}
+			hint = ZSTD_decompressStream(z, &zo, &zi);
+			if (ZSTD_isError(hint)) {
+				eof = -1;
+				break;
 			}
-			/* keep track of last footer */
-			LAST(nfln - nheader) = ibuf;
-			break;
 		}
+		dq[i].on = zo.pos;
+		dec_publish(i, DQ_DONE, eof);
 	}
-	if (noln > nheader ||
-	    !rate && nfln > nheader + nfooter) {
-		if (!quietp) {
-			fwrite("...\n", 1, 4U, stdout);
+	ZSTD_freeDCtx(z);
+	return NULL;
+}
+#endif	/* HAVE_ZSTD_H */
+
+static ssize_t
+read_dq(int UNUSED(fd), void *b, size_t z)
+{
+	size_t i, n;
+	int st;
+
+	pthread_mutex_lock(&dqmtx);
+	for (;;) {
+		i = dqrd % NDQ;
+		if (dqerr || dqeof && dqrd == dqwr) {
+			break;
+		} else if (dq[i].st != DQ_DONE) {
+			pthread_cond_wait(&dqcnd, &dqmtx);
+			continue;
+		} else if (dq[i].on) {
+			break;
 		}
+		/* empty block, skip him */
+		dq[i].st = DQ_FREE;
+		dqrd++;
+		pthread_cond_broadcast(&dqcnd);
 	}
-	/* fast forward footer if there wasn't enough lines */
-	if (nfln > nheader + nfooter) {
-		const size_t beg = LAST(nfln - nheader - nfooter - 0U);
-		const size_t end = LAST(nfln - nheader - nfooter - 1U);
-		fwrite(buf + beg, sizeof(*buf), end - beg, stdout);
-	} else if (nfln > nheader) {
-		const size_t beg = last[0U];
-		const size_t end = last[nfln - nheader];
-		fwrite(buf + beg, sizeof(*buf), end - beg, stdout);
-	}		
-	if (last != _last) {
-		free(last);
+	st = dqerr ? -1 : dq[i].st == DQ_DONE ? 1 : dqeof < 0 ? -1 : 0;
+	pthread_mutex_unlock(&dqmtx);
+	if (st <= 0) {
+		return st;
 	}
-	return 0;
+	/* no need to lock, the block is ours until it's freed */
+	memcpy(b, dq[i].ob + dqoff, n = min_z(z, dq[i].on - dqoff));
+	if ((dqoff += n) >= dq[i].on) {
+		pthread_mutex_lock(&dqmtx);
+		dq[i].st = DQ_FREE;
+		dqrd++;
+		dqoff = 0U;
+		pthread_cond_broadcast(&dqcnd);
+		pthread_mutex_unlock(&dqmtx);
+	}
+	return n;
 }
 
 static int
-sample_rsv(int fd)
+dec_stop(void)
 {
-/* generic sampler */
-	/* number of lines read so far */
-	size_t nfln = 0U;
-	/* fill of BUF, also used as offset of end-of-header in HDR mode */
-	size_t nbuf = 0U;
-	/* index into BUF to the beginning of the last unprocessed line */
-	size_t ibuf = 0U;
-	/* skip up to this line */
-	size_t gap = 0U;
-	/* nfixed buffer oversampling */
-	size_t nfxd = 0U;
-	/* number of octets read per read() */
-	ssize_t nrd;
-	/* offsets to footer */
-	size_t _last[stklmt / 3U];
-	size_t *last = _last;
-	/* reservoir lines
-	 * we store offsets into RSV buffer in LRSV, which is 3 times the
-	 * size of NFIXED to concentrate the memmove()ing
-	 * the kill count for each cell is stored in LGAP */
-	size_t _lrsv[stklmt / 3U];
-	size_t *lrsv = _lrsv;
-	const size_t mult = 4U;
-	/* 3 major states, HEAD BEEF/CAKE and TAIL */
-	enum {
-		EVAL,
-		HEAD,
-		BEEF,
-		FILL,
-		BEXP,
-	} state = EVAL;
+	pthread_mutex_lock(&dqmtx);
+	dqquit = 1;
+	pthread_cond_broadcast(&dqcnd);
+	pthread_mutex_unlock(&dqmtx);
+	for (size_t i = 0U; i < ndqthr; i++) {
+		pthread_join(dqthr[i], NULL);
+	}
+	ndqthr = 0U;
+	return dqerr || dqeof < 0 ? -1 : 0;
+}
 
-#define MEMZCPY(tgt, off, tsz, src, len)				\
-			do {						\
-				const size_t nul = (off) + (len);	\
-				if (nul > (tsz)) {			\
-					size_t nuz = (tsz);		\
-					char *tmp;			\
-					while ((nuz *= 2U) < nul);	\
-					tmp = realloc((tgt), nuz);	\
-					if (UNLIKELY(tmp == NULL)) {	\
-						return -1;		\
-					}				\
-					/* otherwise assign */		\
-					(tgt) = tmp;			\
-					(tsz) = nuz;			\
-				}					\
-				memcpy((tgt) + (off), (src), (len));	\
-			} while (0)
+static int
+dec_start(int codec, int fd, const char *pfx, size_t npfx)
+{
+	void*(*dec)(void*) = NULL;
 
-	with (char *tmp = realloc(buf, BUFSIZ)) {
-		if (UNLIKELY(tmp == NULL)) {
-			/* just bugger off */
+	for (size_t i = 0U; i < countof(dq); i++) {
+		if (dq[i].ob == NULL &&
+		    (dq[i].ob = malloc(BUFSIZ)) == NULL) {
 			return -1;
 		}
-		/* otherwise swap ptrs */
-		buf = tmp;
-		zbuf = BUFSIZ;
-	}
-	with (char *tmp = realloc(rsv, BUFSIZ)) {
-		if (UNLIKELY(tmp == NULL)) {
-			/* just bugger off */
+		if (codec == CODEC_BGZF && dq[i].ib == NULL &&
+		    (dq[i].ib = malloc(BUFSIZ)) == NULL) {
 			return -1;
 		}
-		/* otherwise swap ptrs */
-		rsv = tmp;
-		zrsv = BUFSIZ;
+		dq[i].st = DQ_FREE;
 	}
-	if (nfooter >= countof(_last)) {
-		/* do him with heap space */
-		last = malloc((nfooter + 1U) * sizeof(*last));
+	dqrd = dqoff = dqwr = 0U;
+	dqeof = dqerr = dqquit = 0;
+	dqfd = fd;
+	dqpfx = pfx;
+	dqnpfx = npfx;
+	ndqthr = 0U;
+
+	switch (codec) {
+#if defined HAVE_ZLIB_H
+	case CODEC_GZ:
+		dec = dec_gz;
+		break;
+	case CODEC_BGZF:
+		dec = dec_bgzf;
+		/* blocks are independent, inflate them in parallel */
+		for (size_t i = 0U; i < nthr && i + 1U < countof(dqthr); i++) {
+			if (pthread_create(dqthr + ndqthr, NULL,
+					   dec_bgzf_wk, NULL)) {
+				break;
+			}
+			ndqthr++;
+		}
+		if (!ndqthr) {
+			return -1;
+		}
+		break;
+#endif	/* HAVE_ZLIB_H */
+#if defined HAVE_ZSTD_H
+	case CODEC_ZST:
+		dec = dec_zst;
+		break;
+#endif	/* HAVE_ZSTD_H */
+	default:
+		return -1;
 	}
-	if (mult * nfixed >= countof(_lrsv)) {
-		/* do her with heap space */
-		lrsv = malloc((mult * nfixed + 1U) * sizeof(*lrsv));
+	if (pthread_create(dqthr + ndqthr, NULL, dec, NULL)) {
+		dec_stop();
+		return -1;
 	}
+	ndqthr++;
+	return 0;
+}
 
-	/* deal with header */
-	while ((nrd = read(fd, buf + nbuf, zbuf - nbuf)) > 0) {
-		/* calc next round's NBUF already */
-		nbuf += nrd;
+static void
+dec_free(void)
+{
+	for (size_t i = 0U; i < countof(dq); i++) {
+		free(dq[i].ib);
+		free(dq[i].ob);
+	}
+	return;
+}
+#endif	/* HAVE_ZLIB_H || HAVE_ZSTD_H */
+
+/* chain of files, compressed ones are run through the decoder, what's
+ * been peeked at to find out (CHPFX) is served first otherwise */
+static char *const *chn;
+static size_t nchn;
+static size_t ichn;
+/* current and next file in the chain */
+static int chfd = -1;
+static int nxfd = -1;
+static const char *chfn;
+static const char *nxfn;
+static int chrc;
+static unsigned char chpfx[18U];
+static size_t chnpfx;
+static int chdq;
 
-		switch (state) {
-		case EVAL:
-			if (!nheader) {
-				goto fill;
-			}
-			/* otherwise let HEAD state decide */
-			state = HEAD;
-		case HEAD:
-			for (const char *x;
-			     (x = memchr(buf + ibuf, '\n', nbuf - ibuf));) {
-				const size_t o = ibuf;
+static int
+chain_open(const char *fn)
+{
+	int fd;
 
-				ibuf = ++x - buf;
-				fwrite(buf + o, sizeof(*buf), ibuf - o, stdout);
+	if (fn[0U] == '-' && fn[1U] == '\0') {
+		/* stdin ... *sigh* */
+		return STDIN_FILENO;
+	} else if (UNLIKELY((fd = open(fn, O_RDONLY)) < 0)) {
+		error("\
+Error: cannot open file `%s'", fn);
+		chrc = -1;
+		return -1;
+	}
+#if defined POSIX_FADV_WILLNEED
+	/* have the kernel read ahead while we're busy with the
+	 * previous file, that's all the concurrency we need */
+	(void)posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif	/* POSIX_FADV_WILLNEED */
+	return fd;
+}
 
-				if (++nfln >= nheader) {
-					if (UNLIKELY(!nfixed)) {
-						/* that's it */
-						return 0;
-					}
-					/* otherwise the most generic mode */
-					goto fill;
-				}
+static void
+chain_peek(void)
+{
+/* find out whether CHFD is compressed and start the decoder if so */
+	chnpfx = 0U;
+#if defined HAVE_ZLIB_H || defined HAVE_ZSTD_H
+	for (ssize_t nrd;
+	     chnpfx < sizeof(chpfx) &&
+		     (nrd = read(chfd, chpfx + chnpfx,
+				 sizeof(chpfx) - chnpfx)) > 0;
+	     chnpfx += nrd);
+	with (const int codec = dec_magic(chpfx, chnpfx)) {
+		if (codec == CODEC_NONE) {
+			break;
+		} else if (UNLIKELY(dec_start(codec, chfd, (const char*)chpfx,
+					      chnpfx) < 0)) {
+			errno = 0, error("\
+Error: cannot set up decompression for `%s'", chfn);
+			chrc = -1;
+			/* skip this one */
+			if (chfd > STDIN_FILENO) {
+				close(chfd);
 			}
-			goto wrap;
-
-		wrap:
-			if (LIKELY(nbuf < zbuf / 2U)) {
-				/* no need for buffer juggling */
-				break;
-			} else 	if (UNLIKELY(!ibuf)) {
-				/* great, try a resize */
-				const size_t nuz = zbuf * 2U;
-				char *tmp = realloc(buf, nuz);
+			chfd = -1;
+		} else {
+			chdq = 1;
+		}
+		chnpfx = 0U;
+	}
+#endif	/* HAVE_ZLIB_H || HAVE_ZSTD_H */
+	return;
+}
 
-				if (UNLIKELY(tmp == NULL)) {
-					return -1;
-				}
-				/* otherwise assign and retry */
-				buf = tmp;
-				zbuf = nuz;
-			} else if (LIKELY(ibuf < nbuf)) {
-				memmove(buf, buf + ibuf, nbuf - ibuf);
-				nbuf -= ibuf;
-				ibuf = 0U;
-			}
-			break;
+static ssize_t
+chain_rd(void *b, size_t z)
+{
+/* read from the current file in the chain */
+	if (chnpfx) {
+		const size_t n = min_z(z, chnpfx);
 
-		fill:
-			state = FILL;
-		case FILL:
-			for (const char *x;
-			     nfln - nheader < nfixed &&
-				     (x = memchr(buf + ibuf, '\n', nbuf - ibuf));
-			     nfln++) {
-				/* keep track of footers */
-				lrsv[nfln - nheader] = ibuf;
-				LAST(nfln - nheader) = ibuf;
-				ibuf = ++x - buf;
-			}
-			for (const char *x;
-			     nfln - nheader >= nfixed &&
-				     (x = memchr(buf + ibuf, '\n', nbuf - ibuf));
-			     ) {
-				LAST(nfln - nheader) = ibuf;
-				ibuf = ++x - buf;
+		memcpy(b, chpfx, n);
+		memmove(chpfx, chpfx + n, chnpfx -= n);
+		return n;
+	}
+#if defined HAVE_ZLIB_H || defined HAVE_ZSTD_H
+	if (chdq) {
+		return read_dq(chfd, b, z);
+	}
+#endif	/* HAVE_ZLIB_H || HAVE_ZSTD_H */
+	return read(chfd, b, z);
+}
 
-				if (++nfln - nheader >= nfixed + nfooter) {
-					goto beef;
-				}
-			}
-			goto over;
+static ssize_t
+read_chain(int UNUSED(fd), void *b, size_t z)
+{
+	ssize_t nrd = 0;
 
-		beef:
-			state = BEEF;
-			/* take on the reservoir */
-			MEMZCPY(rsv, 0U, zrsv, buf + lrsv[0U],
-				LAST(nfln - nheader - nfooter) - lrsv[0U]);
-			lrsv[nfixed] = LAST(nfln - nheader - nfooter);
-			for (size_t i = nfixed + 1U; i > 0; i--) {
-				lrsv[i - 1U] -= lrsv[0U];
+	while (chfd < 0 || (nrd = chain_rd(b, z)) <= 0) {
+		if (chdq) {
+			chdq = 0;
+#if defined HAVE_ZLIB_H || defined HAVE_ZSTD_H
+			if (UNLIKELY(dec_stop() < 0 || nrd < 0)) {
+				errno = 0, error("\
+Error: cannot decompress `%s'", chfn);
+				chrc = -1;
 			}
+#endif	/* HAVE_ZLIB_H || HAVE_ZSTD_H */
+		} else if (UNLIKELY(nrd < 0)) {
+			error("\
+Error: cannot read file `%s'", chfn);
+			chrc = -1;
+		}
+		if (chfd > STDIN_FILENO) {
+			close(chfd);
+		}
+		/* advance the chain, skipping unopenable files */
+		for (chfd = nxfd, chfn = nxfn, nxfd = -1;
+		     chfd < 0 && ichn < nchn; ichn++) {
+			chfd = chain_open(chfn = chn[ichn]);
+		}
+		if (chfd < 0) {
+			/* chain exhausted */
+			return 0;
+		}
+		/* open the next one already */
+		for (; nxfd < 0 && ichn < nchn; ichn++) {
+			nxfd = chain_open(nxfn = chn[ichn]);
+		}
+		chain_peek();
+		nrd = 0;
+	}
+	return nrd;
+}
 
-			nfxd = nfixed;
-
-			/* we need one more sample step because the
-			 * condition above that got us here goes one
-			 * step further than it should, lest we print
-			 * the ellipsis when there's exactly
-			 * nheader + nfooter lines in the buffer */
-		case BEEF:
-			for (const char *x;
-			     (x = memchr(buf + ibuf, '\n', nbuf - ibuf));
-			     ibuf = x - buf + 1U, nfln++) {
-				/* current line length */
-				const size_t y =
-					LAST(nfln - nheader - nfooter + 1U) -
-					LAST(nfln - nheader - nfooter + 0U);
+
+/* output
+ * samplers push their data through WR, normally that's just stdio
+ * but with -o FILE.gz or -o FILE.zst it's a ring of blocks that a
+ * couple of encoder threads compress and write out in order */
+static size_t
+wr_stdio(const void *b, size_t z)
+{
+	return fwrite(b, sizeof(char), z, stdout);
+}
 
-				/* keep track of footers */
-				LAST(nfln - nheader) = ibuf;
+static size_t(*wr)(const void*, size_t) = wr_stdio;
+
+#if defined HAVE_ZLIB_H || defined HAVE_ZSTD_H
+#define NEQ	(32U)
+/* BGZF blocks must not exceed 64k once compressed */
+#define ZEQ_BGZF	(0xff00U)
+#define ZEQ_ZST		(1U << 18U)
+static struct {
+	/* uncompressed input */
+	char *ib;
+	size_t in;
+	/* compressed output */
+	unsigned char *ob;
+	size_t on;
+	int st;
+} eq[NEQ];
+/* writer position, and producer position */
+static size_t eqrd;
+static size_t eqwr;
+static size_t zeq;
+static int eqcodec;
+static int eqfd = -1;
+/* write error, producer finished, somebody's writing */
+static int eqerr;
+static int eqquit;
+static int eqbusy;
+/* producer holds the block at EQWR */
+static int eqown;
+static pthread_mutex_t eqmtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t eqcnd = PTHREAD_COND_INITIALIZER;
+static pthread_t eqthr[16U];
+static size_t neqthr;
 
-				if (nfln - nheader >= 4U * nfixed) {
-					/* switch to gap sampling */
-					goto bexp;
-				}
+static int
+write_all(int fd, const void *b, size_t z)
+{
+	for (ssize_t nwr; z; b = (const char*)b + nwr, z -= nwr) {
+		if (UNLIKELY((nwr = write(fd, b, z)) <= 0)) {
+			return -1;
+		}
+	}
+	return 0;
+}
 
-				/* keep with probability nfixed / nfln */
-				if (runifu32b(nfln - nheader) >= nfixed) {
-					continue;
-				}
+#if defined HAVE_ZLIB_H
+static ssize_t
+bgzf_deflate(z_stream *z, unsigned char *ob, const char *b, size_t n)
+{
+/* deflate N bytes of B into a BGZF block at OB, return its size */
+	static const unsigned char hdr[] = {
+		0x1fU, 0x8bU, 8U, 4U, 0U, 0U, 0U, 0U, 0U, 0xffU,
+		6U, 0U, 'B', 'C', 2U, 0U,
+	};
+	const uint32_t crc = crc32(0L, (const unsigned char*)b, n);
+	size_t on;
+
+	deflateReset(z);
+	z->next_in = deconst(b);
+	z->avail_in = n;
+	z->next_out = ob + 18U;
+	z->avail_out = BUFSIZ - 18U - 8U;
+	if (UNLIKELY(deflate(z, Z_FINISH) != Z_STREAM_END)) {
+		return -1;
+	}
+	on = 18U + z->total_out + 8U;
+	memcpy(ob, hdr, sizeof(hdr));
+	ob[16U] = (unsigned char)(on - 1U);
+	ob[17U] = (unsigned char)((on - 1U) >> 8U);
+	for (size_t i = 0U; i < 4U; i++) {
+		ob[on - 8U + i] = (unsigned char)(crc >> (8U * i));
+		ob[on - 4U + i] = (unsigned char)(n >> (8U * i));
+	}
+	return on;
+}
+#endif	/* HAVE_ZLIB_H */
 
-				if (UNLIKELY(nfxd >= mult * nfixed)) {
-					/* condense lrsv */
-					compactify(lrsv, nfxd, nfixed);
-					nfxd = nfixed;
+static void*
+enc_wk(void *UNUSED(arg))
+{
+/* compress blocks in whatever order they come, write them in order */
+#if defined HAVE_ZLIB_H
+	z_stream z;
+#endif	/* HAVE_ZLIB_H */
+#if defined HAVE_ZSTD_H
+	ZSTD_CCtx *zc = NULL;
+#endif	/* HAVE_ZSTD_H */
+
+	switch (eqcodec) {
+#if defined HAVE_ZLIB_H
+	case CODEC_BGZF:
+		memset(&z, 0, sizeof(z));
+		if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+				 -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			goto fail;
+		}
+		break;
+#endif	/* HAVE_ZLIB_H */
+#if defined HAVE_ZSTD_H
+	case CODEC_ZST:
+		if ((zc = ZSTD_createCCtx()) == NULL) {
+			goto fail;
+		}
+		break;
+#endif	/* HAVE_ZSTD_H */
+	default:
+		goto fail;
+	}
+	for (;;) {
+		size_t i = NEQ;
+		ssize_t on = -1;
+
+		pthread_mutex_lock(&eqmtx);
+		for (;;) {
+			for (size_t j = eqrd; j < eqwr; j++) {
+				if (eq[j % NEQ].st == DQ_FILL) {
+					i = j % NEQ;
+					break;
 				}
-
-				/* bang this line */
-				MEMZCPY(rsv, lrsv[nfxd], zrsv,
-					buf + LAST(nfln - nheader - nfooter), y);
-				/* and memorise him */
-				lrsv[nfxd + 1U] = lrsv[nfxd] + y;
-				nfxd++;
 			}
-			goto over;
-
-		bexp:
-			gap = nfln - nheader +
-				rexp32(nfln - nheader - nfixed, nfln);
-			state = BEXP;
-		case BEXP:
-			for (const char *x;
-			     nfln - nheader < gap &&
-				     (x = memchr(buf + ibuf, '\n', nbuf - ibuf));
-			     ibuf = x - buf + 1U, nfln++) {
-				/* every line could be our last, so keep
-				 * track of them */
-				LAST(nfln - nheader) = ibuf;
+			if (i < NEQ || eqquit) {
+				break;
 			}
-			for (const char *x;
-			     nfln - nheader >= gap &&
-				     (x = memchr(buf + ibuf, '\n', nbuf - ibuf));
-				) {
-				/* current line length */
-				const size_t y =
-					LAST(nfln - nheader - nfooter + 1U) -
-					LAST(nfln - nheader - nfooter + 0U);
+			pthread_cond_wait(&eqcnd, &eqmtx);
+		}
+		if (i < NEQ) {
+			eq[i].st = DQ_BUSY;
+		}
+		pthread_mutex_unlock(&eqmtx);
 
-				/* keep track of footers */
-				LAST(nfln - nheader) = ibuf;
+		if (i >= NEQ) {
+			break;
+		}
+		switch (eqcodec) {
+#if defined HAVE_ZLIB_H
+		case CODEC_BGZF:
+			on = bgzf_deflate(&z, eq[i].ob, eq[i].ib, eq[i].in);
+			break;
+#endif	/* HAVE_ZLIB_H */
+#if defined HAVE_ZSTD_H
+		case CODEC_ZST:
+			with (size_t r) {
+				r = ZSTD_compressCCtx(zc, eq[i].ob,
+						      ZSTD_compressBound(zeq),
+						      eq[i].ib, eq[i].in, 3);
+				on = ZSTD_isError(r) ? -1 : (ssize_t)r;
+			}
+			break;
+#endif	/* HAVE_ZSTD_H */
+		default:
+			break;
+		}
 
-				if (UNLIKELY(nfxd >= mult * nfixed)) {
-					/* condense lrsv */
-					compactify(lrsv, nfxd, nfixed);
-					nfxd = nfixed;
-				}
+		pthread_mutex_lock(&eqmtx);
+		eq[i].on = on >= 0 ? on : 0U;
+		eq[i].st = DQ_DONE;
+		eqerr = on >= 0 ? eqerr : -1;
+		/* write out what's ready, unless somebody else is on it */
+		while (!eqbusy && eqrd < eqwr && eq[eqrd % NEQ].st == DQ_DONE) {
+			const size_t j = eqrd % NEQ;
+			int r;
+
+			eqbusy = 1;
+			pthread_mutex_unlock(&eqmtx);
+			r = write_all(eqfd, eq[j].ob, eq[j].on);
+			pthread_mutex_lock(&eqmtx);
+			eqerr = r >= 0 ? eqerr : -1;
+			eqbusy = 0;
+			eq[j].st = DQ_FREE;
+			eqrd++;
+		}
+		pthread_cond_broadcast(&eqcnd);
+		pthread_mutex_unlock(&eqmtx);
+	}
+#if defined HAVE_ZLIB_H
+	if (eqcodec == CODEC_BGZF) {
+		deflateEnd(&z);
+	}
+#endif	/* HAVE_ZLIB_H */
+#if defined HAVE_ZSTD_H
+	ZSTD_freeCCtx(zc);
+#endif	/* HAVE_ZSTD_H */
+	return NULL;
+
+fail:
+	pthread_mutex_lock(&eqmtx);
+	eqerr = -1;
+	pthread_mutex_unlock(&eqmtx);
+	return NULL;
+}
 
-				/* bang this line */
-				MEMZCPY(rsv, lrsv[nfxd], zrsv,
-					buf +  LAST(nfln - nheader - nfooter), y);
-				/* and memorise him */
-				lrsv[nfxd + 1U] = lrsv[nfxd] + y;
-				nfxd++;
+static void
+enc_submit(void)
+{
+	eqown = 0;
+	pthread_mutex_lock(&eqmtx);
+	eq[eqwr % NEQ].st = DQ_FILL;
+	eqwr++;
+	pthread_cond_broadcast(&eqcnd);
+	pthread_mutex_unlock(&eqmtx);
+	return;
+}
 
-				ibuf = x - buf + 1U;
-				nfln++;
-				goto bexp;
+static size_t
+wr_enc(const void *b, size_t z)
+{
+/* append B to the current block, hand it over when full */
+	for (size_t n = z; n;) {
+		const size_t i = eqwr % NEQ;
+		size_t k;
+
+		if (!eqown) {
+			/* wait for the block to be written out */
+			pthread_mutex_lock(&eqmtx);
+			while (eq[i].st != DQ_FREE && !eqerr) {
+				pthread_cond_wait(&eqcnd, &eqmtx);
 			}
-			goto over;
+			pthread_mutex_unlock(&eqmtx);
+			if (UNLIKELY(eqerr)) {
+				return z - n;
+			}
+			eq[i].in = 0U;
+			eqown = 1;
+		}
+		k = min_z(n, zeq - eq[i].in);
+		memcpy(eq[i].ib + eq[i].in, b, k);
+		eq[i].in += k;
+		b = (const char*)b + k;
+		n -= k;
+		if (eq[i].in >= zeq) {
+			enc_submit();
+		}
+	}
+	return z;
+}
 
-		over:
-			/* beef buffer overrun */
-			with (const size_t frst = FIRST(nfln - nheader)) {
-				if (LIKELY(nbuf < zbuf / 2U)) {
-					/* just read more stuff */
-					break;
-				} else if (UNLIKELY(!frst || frst == ibuf ||
-						    nfln - nheader <=
+static int
+enc_start(int codec, int fd)
+{
+	zeq = codec == CODEC_BGZF ? ZEQ_BGZF : ZEQ_ZST;
+	for (size_t i = 0U; i < countof(eq); i++) {
+		size_t zob = BUFSIZ;
+
+#if defined HAVE_ZSTD_H
+		zob = codec == CODEC_ZST ? ZSTD_compressBound(zeq) : zob;
+#endif	/* HAVE_ZSTD_H */
+		if (UNLIKELY((eq[i].ib = malloc(zeq)) == NULL ||
+			     (eq[i].ob = malloc(zob)) == NULL)) {
+			return -1;
+		}
+		eq[i].in = 0U;
+		eq[i].st = DQ_FREE;
+	}
+	eqrd = eqwr = 0U;
+	eqerr = eqquit = eqbusy = eqown = 0;
+	eqcodec = codec;
+	eqfd = fd;
+	neqthr = 0U;
+	for (size_t i = 0U; i < nthr && i < countof(eqthr); i++) {
+		if (pthread_create(eqthr + neqthr, NULL, enc_wk, NULL)) {
+			break;
+		}
+		neqthr++;
+	}
+	return neqthr ? 0 : -1;
+}
+
+static void
+enc_free(void)
+{
+	for (size_t i = 0U; i < countof(eq); i++) {
+		free(eq[i].ib);
+		free(eq[i].ob);
+		eq[i].ib = NULL;
+		eq[i].ob = NULL;
+	}
+	return;
+}
+
+static int
+enc_stop(void)
+{
+	/* hand over what's left */
+	if (eqown && eq[eqwr % NEQ].in) {
+		enc_submit();
+	}
+	pthread_mutex_lock(&eqmtx);
+	eqquit = 1;
+	pthread_cond_broadcast(&eqcnd);
+	pthread_mutex_unlock(&eqmtx);
+	for (size_t i = 0U; i < neqthr; i++) {
+		pthread_join(eqthr[i], NULL);
+	}
+	neqthr = 0U;
+	if (eqcodec == CODEC_BGZF && !eqerr) {
+		/* the customary empty block to mark the end */
+		static const unsigned char eof[] = {
+			0x1fU, 0x8bU, 8U, 4U, 0U, 0U, 0U, 0U, 0U, 0xffU,
+			6U, 0U, 'B', 'C', 2U, 0U, 0x1bU, 0U,
+			3U, 0U, 0U, 0U, 0U, 0U, 0U, 0U, 0U, 0U,
+		};
+		eqerr = write_all(eqfd, eof, sizeof(eof));
+	}
+	enc_free();
+	return eqerr;
+}
+#endif	/* HAVE_ZLIB_H || HAVE_ZSTD_H */
+
+static int
+out_open(const char *fn)
+{
+/* redirect output to FN, compressing if its suffix says so */
+	const size_t n = strlen(fn);
+	const int gzp = n > 3U && !strcmp(fn + n - 3U, ".gz");
+	const int zstp = n > 4U && !strcmp(fn + n - 4U, ".zst");
+	int fd;
+
+	if (!gzp && !zstp) {
+		if (UNLIKELY(freopen(fn, "w", stdout) == NULL)) {
+			error("\
+Error: cannot open file `%s' for writing", fn);
+			return -1;
+		}
+		return 0;
+	}
+#if !defined HAVE_ZLIB_H
+	if (gzp) {
+		errno = 0, error("\
+Error: cannot write `%s', no gzip support", fn);
+		return -1;
+	}
+#endif	/* !HAVE_ZLIB_H */
+#if !defined HAVE_ZSTD_H
+	if (zstp) {
+		errno = 0, error("\
+Error: cannot write `%s', no zstd support", fn);
+		return -1;
+	}
+#endif	/* !HAVE_ZSTD_H */
+	if (UNLIKELY((fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)) {
+		error("\
+Error: cannot open file `%s' for writing", fn);
+		return -1;
+	}
+#if defined HAVE_ZLIB_H || defined HAVE_ZSTD_H
+	if (UNLIKELY(enc_start(gzp ? CODEC_BGZF : CODEC_ZST, fd) < 0)) {
+		errno = 0, error("\
+Error: cannot set up compression for `%s'", fn);
+		enc_free();
+		close(fd);
+		return -1;
+	}
+	wr = wr_enc;
+#else  /* !HAVE_ZLIB_H && !HAVE_ZSTD_H */
+	close(fd);
+#endif	/* HAVE_ZLIB_H || HAVE_ZSTD_H */
+	return 0;
+}
+
+static int
+out_close(void)
+{
+	int rc = fflush(stdout);
+
+#if defined HAVE_ZLIB_H || defined HAVE_ZSTD_H
+	if (wr == wr_enc) {
+		rc |= enc_stop();
+		rc |= close(eqfd);
+		wr = wr_stdio;
+	}
+#endif	/* HAVE_ZLIB_H || HAVE_ZSTD_H */
+	return rc ? -1 : 0;
+}
+
+/* fan-out
+ * some modes write to several outputs at once, those are plain files
+ * with a large buffer each, compressing them is left to the user */
+static FILE **fo;
+static size_t nfo;
+
+static int
+fo_name(char *restrict tgt, size_t z, const char *pat, size_t i)
+{
+/* expand the one %d, %Nd or %0Nd in PAT with I into TGT of size Z */
+	const char *p = strchr(pat, '%');
+	char *q;
+	size_t w, n;
+	int zerop;
+
+	if (UNLIKELY(p == NULL || (size_t)(p - pat) >= z)) {
+		return -1;
+	}
+	zerop = p[1U] == '0';
+	w = strtoul(p + 1U, &q, 10);
+	if (UNLIKELY(*q != 'd' || strchr(q, '%') != NULL || w >= z)) {
+		return -1;
+	}
+	n = p - pat;
+	memcpy(tgt, pat, n);
+	with (char d[24U]) {
+		size_t nd = 0U;
+
+		do {
+			d[nd++] = (char)('0' + i % 10U);
+		} while (i /= 10U);
+		for (; nd < w && n < z; w--) {
+			tgt[n++] = zerop ? '0' : ' ';
+		}
+		for (; nd && n < z; tgt[n++] = d[--nd]);
+	}
+	if (UNLIKELY(n + strlen(q + 1U) >= z)) {
+		return -1;
+	}
+	strcpy(tgt + n, q + 1U);
+	return 0;
+}
+
+static int
+fo_open(char *const *fns, size_t nfns, size_t n)
+{
+/* open N outputs, named FNS or, if there's only one, after the
+ * pattern in FNS[0U] */
+	char fn[4096U];
+
+	if (nfns != n && (nfns != 1U || fo_name(fn, sizeof(fn), *fns, 0U))) {
+		errno = 0, error("\
+Error: need %zu output files or a pattern with %%d", n);
+		return -1;
+	} else if (UNLIKELY((fo = calloc(n, sizeof(*fo))) == NULL)) {
+		return -1;
+	}
+	for (nfo = 0U; nfo < n; nfo++) {
+		const char *f = fns[nfo % nfns];
+		size_t nf;
+
+		if (nfns != n) {
+			fo_name(fn, sizeof(fn), *fns, nfo);
+			f = fn;
+		}
+		nf = strlen(f);
+		if (nf > 3U && !strcmp(f + nf - 3U, ".gz") ||
+		    nf > 4U && !strcmp(f + nf - 4U, ".zst")) {
+			errno = 0, error("\
+Error: cannot compress `%s', only single outputs are compressed", f);
+			return -1;
+		} else if (UNLIKELY((fo[nfo] = fopen(f, "w")) == NULL)) {
+			error("\
+Error: cannot open file `%s' for writing", f);
+			return -1;
+		}
+		setvbuf(fo[nfo], NULL, _IOFBF, 4U * BUFSIZ);
+	}
+	return 0;
+}
+
+static int
+fo_close(void)
+{
+	int rc = 0;
+
+	for (size_t i = 0U; i < nfo; i++) {
+		rc |= fclose(fo[i]);
+	}
+	free(fo);
+	fo = NULL;
+	nfo = 0U;
+	return rc ? -1 : 0;
+}
+
+static inline void
+fo_wr(size_t i, const void *b, size_t z)
+{
+/* write B of size Z to output I, or to WR if there's no fan-out */
+	if (UNLIKELY(fo == NULL)) {
+		wr(b, z);
+		return;
+	}
+	fwrite(b, sizeof(char), z, fo[i]);
+	return;
+}
+
+
+/* buffer */
+static char *buf;
+static size_t zbuf;
+/* reservoir */
+static char *rsv;
+static size_t zrsv;
+/* compactify */
+static uint8_t *comp;
+static size_t *idir;
+static size_t zcomp;
+
+/* --unordered, output samples in random rather than input order */
+static int unordp;
+
+static int
+survivors(const size_t m, const size_t n)
+{
+/* helper for reservoir sampling
+ * of M lines, N survive, have IDIR point to them */
+	if (UNLIKELY(m > zcomp)) {
+		/* M is always larger than N */
+		uint8_t *tmpc = realloc(comp, m * sizeof(*comp));
+		size_t *tmpi;
+
+		if (UNLIKELY(tmpc == NULL)) {
+			return -1;
+		}
+		comp = tmpc;
+		tmpi = realloc(idir, m * sizeof(*idir));
+		if (UNLIKELY(tmpi == NULL)) {
+			return -1;
+		}
+		idir = tmpi;
+		zcomp = m;
+	}
+
+	/* prep IDIR buffer */
+	for (size_t i = 0U; i < n; i++) {
+		idir[i] = i;
+	}
+	for (size_t i = n; i < m; i++) {
+		idir[runifu32b(n)] = i;
+	}
+	return 0;
+}
+
+static void
+compactify(size_t *restrict off, const size_t m, const size_t n)
+{
+/* helper for reservoir sampling
+ * compact M lines into N whose offsets are in OFF */
+	size_t o = 0U;
+
+	if (UNLIKELY(survivors(m, n) < 0)) {
+		return;
+	}
+	/* prep compactifier, this is a radix sort */
+	memset(comp, 0, m * sizeof(*comp));
+	/* now sort him */
+	for (size_t i = 0U; i < n; i++) {
+		comp[idir[i]] = 1U;
+	}
+
+	/* ... now move them lines
+	 * we calculate streaks of lines and move them in bulk */
+	for (size_t i = 0U, beg = 0U, end; i < n; beg = end + 1U) {
+		size_t len;
+
+		/* find first line to move, COMP[] is guaranteed to have
+		 * N matches, so stop once they're all moved */
+		for (; !comp[beg]; beg++);
+		for (end = beg + 1U; end < m && comp[end]; end++);
+
+		memmove(rsv + o, rsv + off[beg], len = off[end] - off[beg]);
+
+		/* resolve into lines again */
+		for (size_t j = beg, bof = off[beg]; j < end; j++) {
+			off[i++] = o + off[j] - bof;
+		}
+		o += len;
+	}
+	off[n] = o;
+	return;
+}
+
+static void
+rsv_wr(size_t *restrict off, const size_t m, const size_t n)
+{
+/* helper for reservoir sampling
+ * write N of the M lines whose offsets are in OFF, in input order, or
+ * for --unordered in random order, which needs no compaction at all */
+	if (!unordp) {
+		compactify(off, m, n);
+		wr(rsv + off[0U], off[n] - off[0U]);
+		return;
+	} else if (UNLIKELY(survivors(m, n) < 0)) {
+		return;
+	}
+	/* Fisher-Yates, drawing slots from the front of IDIR */
+	for (size_t i = n; i > 0U; i--) {
+		const size_t j = runifu32b(i);
+		const size_t k = idir[j];
+
+		wr(rsv + off[k], off[k + 1U] - off[k]);
+		idir[j] = idir[i - 1U];
+	}
+	return;
+}
+
+static void
+unord_wr(const char *s, size_t z, size_t k)
+{
+/* write the records in S of size Z, the first K of them in random
+ * order if --unordered is in effect */
+	size_t *o, *e;
+	size_t y = 0U;
+
+	if (!unordp || k < 2U ||
+	    UNLIKELY((o = malloc(2U * k * sizeof(*o))) == NULL)) {
+		wr(s, z);
+		return;
+	}
+	/* record I spans O[I] to E[I] */
+	e = o + k;
+	for (size_t i = 0U; i < k; i++) {
+		const char *x = recchr(s + y, z - y);
+
+		o[i] = y;
+		e[i] = y = x != NULL ? (size_t)(x + 1 - s) : z;
+	}
+	for (size_t i = k; i > 0U; i--) {
+		const size_t j = runifu32b(i);
+
+		wr(s + o[j], e[j] - o[j]);
+		o[j] = o[i - 1U];
+		e[j] = e[i - 1U];
+	}
+	wr(s + y, z - y);
+	free(o);
+	return;
+}
+
+/* number of records seen by the last complete sampler run */
+static size_t nrec;
+/* whether the random numbers must be drawn per record, in order */
+static int lockp;
+
+/* record picker for anything but plain random sampling at RATE */
+static int(*pickfn)(const char*, size_t);
+/* consistent sampling, hash threshold and key field, 0 for the record */
+static uint64_t hthr;
+static size_t hfld;
+
+static inline int
+pick(const char *s, size_t n)
+{
+/* whether to sample record S of size N */
+	if (LIKELY(pickfn == NULL)) {
+		return runifu32() < rate;
+	}
+	return pickfn(s, n);
+}
+
+static int
+pick_none(const char *s, size_t n)
+{
+/* pick nothing, for --rest with a rate of 0 */
+	(void)s;
+	(void)n;
+	return 0;
+}
+
+/* with --rest the records that aren't picked go to the fan-out */
+static int restp;
+
+static int
+pick_hash(const char *s, size_t n)
+{
+/* pick S of size N if the hash of its key is below the threshold */
+	n = recdlm(s, n);
+	if (hfld) {
+		s = fld(s, &n, hfld);
+	}
+	return hash64(s, n) < hthr;
+}
+
+/* per-record probabilities, from field PFLD, scaled by PSCL */
+static size_t pfld;
+static double pscl = 1;
+
+static int
+pick_prob(const char *s, size_t n)
+{
+/* pick S of size N with the probability in its field */
+	const double p = fldnum(s, recdlm(s, n), pfld) * pscl;
+	const unsigned int u = runifu32();
+
+	return (double)u < p * 0x1.p32;
+}
+
+static int
+sample_0(int fd)
+{
+	(void)fd;
+	return 0;
+}
+
+static int
+sample_gen(int fd)
+{
+/* generic sampler */
+	/* number of lines read so far */
+	size_t nfln = 0U;
+	/* number of output lines so far */
+	size_t noln = 0U;
+	/* fill of BUF, also used as offset of end-of-header in HDR mode */
+	size_t nbuf = 0U;
+	/* index into BUF to the beginning of the last unprocessed line */
+	size_t ibuf = 0U;
+	/* number of octets read per read() */
+	ssize_t nrd;
+	/* offsets to footer */
+	size_t _last[stklmt];
+	size_t *last = _last;
+#define LAST(x)		last[(x) % (nfooter + 1U)]
+#define FIRST(x)	((x) > nfooter ? LAST(x) : 0U)
+	/* 3 major states, HEAD BEEF/CAKE and TAIL */
+	enum {
+		EVAL,
+		HEAD,
+		BEEF,
+		TAIL,
+		CAKE,
+	} state = EVAL;
+
+	with (char *tmp = realloc(buf, BUFSIZ)) {
+		if (UNLIKELY(tmp == NULL)) {
+			/* just bugger off */
+			return -1;
+		}
+		/* otherwise swap ptrs */
+		buf = tmp;
+		zbuf = BUFSIZ;
+	}
+
+	if (nfooter >= countof(_last)) {
+		/* better do it with heap space */
+		last = malloc((nfooter + 1U) * sizeof(*last));
+	}
+
+	/* deal with header */
+	while ((nrd = rd(fd, buf + nbuf, zbuf - nbuf)) > 0) {
+		/* calc next round's NBUF already */
+		nbuf += nrd;
+
+		switch (state) {
+		case EVAL:
+			if (rate > UINT32_MAX && !nrsz && !lpfx) {
+				/* oh they want everything printed,
+				 * framed records are checked one by one */
+				wr(buf, nrd);
+				nbuf = 0U;
+				break;
+			} else if (!nfooter && !nheader) {
+				goto cake;
+			} else if (!nheader) {
+				goto tail;
+			}
+			/* otherwise let HEAD state decide */
+			state = HEAD;
+		case HEAD:
+			for (const char *x;
+			     (x = recchr(buf + ibuf, nbuf - ibuf));) {
+				const size_t o = ibuf;
+
+				ibuf = ++x - buf;
+				wr(buf + o, ibuf - o);
+				noln++;
+
+				if (++nfln >= nheader) {
+					if (UNLIKELY(!nfooter && !rate)) {
+						/* that's it */
+						return 0;
+					} else if (!nfooter) {
+						goto cake;
+					}
+					/* otherwise the most generic mode */
+					goto tail;
+				}
+			}
+			goto wrap;
+
+		cake:
+			if (!(quietp & QUIET_LEAD)) {
+				wr(ell, nell);
+			}
+			state = CAKE;
+		case CAKE:
+			/* CAKE is the mode where we don't track tail lines */
+			for (const char *x;
+			     (x = recchr(buf + ibuf, nbuf - ibuf));) {
+				const size_t o = ibuf;
+
+				ibuf = ++x - buf;
+				nfln++;
+
+				/* sample */
+				if (pick(buf + o, ibuf - o)) {
+					wr(buf + o, ibuf - o);
+					noln++;
+				} else if (restp) {
+					fo_wr(0U, buf + o, ibuf - o);
+				}
+			}
+			goto wrap;
+
+		wrap:
+			if (LIKELY(nbuf < zbuf / 2U)) {
+				/* we've got enough buffer, use, him */
+				break;
+			} else if (UNLIKELY(!ibuf)) {
+				/* great, try a resize */
+				const size_t nuz = zbuf * 2U;
+				char *tmp = realloc(buf, nuz);
+
+				if (UNLIKELY(tmp == NULL)) {
+					return -1;
+				}
+				/* otherwise assign and retry */
+				buf = tmp;
+				zbuf = nuz;
+			} else if (LIKELY(ibuf < nbuf)) {
+				memmove(buf, buf + ibuf, nbuf - ibuf);
+			}
+			nbuf -= ibuf;
+			ibuf = 0U;
+			break;
+
+		tail:
+			state = TAIL;
+		case TAIL:
+			for (const char *x;
+			     (x = recchr(buf + ibuf, nbuf - ibuf));) {
+				/* keep track of footers */
+				LAST(nfln - nheader) = ibuf;
+				ibuf = ++x - buf;
+
+				if (++nfln > nheader + nfooter && rate) {
+					goto beef;
+				}
+			}
+			goto over;
+
+		beef:
+			if (!(quietp & QUIET_LEAD)) {
+				wr(ell, nell);
+			}
+			state = BEEF;
+			/* we need one more sample step because the
+			 * condition above that got us here goes one
+			 * step further than it should, lest we print
+			 * the ellipsis when there's exactly
+			 * nheader + nfoooter lines in the buffer */
+			goto sample;
+
+		case BEEF:
+			for (const char *x;
+			     (x = recchr(buf + ibuf, nbuf - ibuf));) {
+				/* keep track of footers */
+				LAST(nfln - nheader) = ibuf;
+				ibuf = ++x - buf;
+
+				nfln++;
+
+			sample:
+				/* sample */
+				with (const size_t this =
+				      LAST(nfln - nheader + 0U),
+				      next = LAST(nfln - nheader + 1U)) {
+					if (pick(buf + this, next - this)) {
+						wr(buf + this, next - this);
+						noln++;
+					} else if (restp) {
+						fo_wr(0U, buf + this,
+						      next - this);
+					}
+				}
+			}
+			goto over;
+
+		over:
+			/* beef buffer overrun handling */
+			with (const size_t frst = FIRST(nfln - nheader)) {
+				if (LIKELY(nbuf < zbuf / 2U)) {
+					/* just read more stuff */
+					break;
+				} else if (UNLIKELY(!frst || frst == ibuf)) {
+					/* resize and retry */
+					const size_t nuz = zbuf * 2U;
+					char *tmp = realloc(buf, nuz);
+
+					if (UNLIKELY(tmp == NULL)) {
+						return -1;
+					}
+					/* otherwise assign and retry */
+					buf = tmp;
+					zbuf = nuz;
+					break;
+				}
+				memmove(buf, buf + frst, nbuf - frst);
+				for (size_t i = 0U,
+					     n = min_z(nfooter + 1U,
+						       nfln - nheader);
+				     i < n; i++) {
+					last[i] -= frst;
+				}
+				nbuf -= frst;
+				ibuf -= frst;
+			}
+			/* keep track of last footer */
+			LAST(nfln - nheader) = ibuf;
+			break;
+		}
+	}
+	if (noln > nheader ||
+	    !rate && nfln > nheader + nfooter) {
+		if (!(quietp & QUIET_TRAIL)) {
+			wr(ell, nell);
+		}
+	}
+	/* fast forward footer if there wasn't enough lines */
+	if (nfln > nheader + nfooter) {
+		const size_t beg = LAST(nfln - nheader - nfooter - 0U);
+		const size_t end = LAST(nfln - nheader - nfooter - 1U);
+		wr(buf + beg, end - beg);
+	} else if (nfln > nheader) {
+		const size_t beg = last[0U];
+		const size_t end = last[nfln - nheader];
+		wr(buf + beg, end - beg);
+	}		
+	if (last != _last) {
+		free(last);
+	}
+	nrec = nfln;
+	return 0;
+}
+
+static int
+sample_rsv(int fd)
+{
+/* generic sampler */
+	/* number of lines read so far */
+	size_t nfln = 0U;
+	/* fill of BUF, also used as offset of end-of-header in HDR mode */
+	size_t nbuf = 0U;
+	/* index into BUF to the beginning of the last unprocessed line */
+	size_t ibuf = 0U;
+	/* skip up to this line */
+	size_t gap = 0U;
+	/* nfixed buffer oversampling */
+	size_t nfxd = 0U;
+	/* number of octets read per read() */
+	ssize_t nrd;
+	/* offsets to footer */
+	size_t _last[stklmt / 3U];
+	size_t *last = _last;
+	/* reservoir lines
+	 * we store offsets into RSV buffer in LRSV, which is 3 times the
+	 * size of NFIXED to concentrate the memmove()ing
+	 * the kill count for each cell is stored in LGAP */
+	size_t _lrsv[stklmt / 3U];
+	size_t *lrsv = _lrsv;
+	const size_t mult = 4U;
+	/* 3 major states, HEAD BEEF/CAKE and TAIL */
+	enum {
+		EVAL,
+		HEAD,
+		BEEF,
+		FILL,
+		BEXP,
+	} state = EVAL;
+
+#define MEMZCPY(tgt, off, tsz, src, len)				\
+			do {						\
+				const size_t nul = (off) + (len);	\
+				if (nul > (tsz)) {			\
+					size_t nuz = (tsz);		\
+					char *tmp;			\
+					while ((nuz *= 2U) < nul);	\
+					tmp = realloc((tgt), nuz);	\
+					if (UNLIKELY(tmp == NULL)) {	\
+						return -1;		\
+					}				\
+					/* otherwise assign */		\
+					(tgt) = tmp;			\
+					(tsz) = nuz;			\
+				}					\
+				memcpy((tgt) + (off), (src), (len));	\
+			} while (0)
+
+	with (char *tmp = realloc(buf, BUFSIZ)) {
+		if (UNLIKELY(tmp == NULL)) {
+			/* just bugger off */
+			return -1;
+		}
+		/* otherwise swap ptrs */
+		buf = tmp;
+		zbuf = BUFSIZ;
+	}
+	with (char *tmp = realloc(rsv, BUFSIZ)) {
+		if (UNLIKELY(tmp == NULL)) {
+			/* just bugger off */
+			return -1;
+		}
+		/* otherwise swap ptrs */
+		rsv = tmp;
+		zrsv = BUFSIZ;
+	}
+	if (nfooter >= countof(_last)) {
+		/* do him with heap space */
+		last = malloc((nfooter + 1U) * sizeof(*last));
+	}
+	if (mult * nfixed >= countof(_lrsv)) {
+		/* do her with heap space */
+		lrsv = malloc((mult * nfixed + 1U) * sizeof(*lrsv));
+	}
+
+	/* deal with header */
+	while ((nrd = rd(fd, buf + nbuf, zbuf - nbuf)) > 0) {
+		/* calc next round's NBUF already */
+		nbuf += nrd;
+
+		switch (state) {
+		case EVAL:
+			if (!nheader) {
+				goto fill;
+			}
+			/* otherwise let HEAD state decide */
+			state = HEAD;
+		case HEAD:
+			for (const char *x;
+			     (x = recchr(buf + ibuf, nbuf - ibuf));) {
+				const size_t o = ibuf;
+
+				ibuf = ++x - buf;
+				wr(buf + o, ibuf - o);
+
+				if (++nfln >= nheader) {
+					if (UNLIKELY(!nfixed)) {
+						/* that's it */
+						return 0;
+					}
+					/* otherwise the most generic mode */
+					goto fill;
+				}
+			}
+			goto wrap;
+
+		wrap:
+			if (LIKELY(nbuf < zbuf / 2U)) {
+				/* no need for buffer juggling */
+				break;
+			} else 	if (UNLIKELY(!ibuf)) {
+				/* great, try a resize */
+				const size_t nuz = zbuf * 2U;
+				char *tmp = realloc(buf, nuz);
+
+				if (UNLIKELY(tmp == NULL)) {
+					return -1;
+				}
+				/* otherwise assign and retry */
+				buf = tmp;
+				zbuf = nuz;
+			} else if (LIKELY(ibuf < nbuf)) {
+				memmove(buf, buf + ibuf, nbuf - ibuf);
+				nbuf -= ibuf;
+				ibuf = 0U;
+			}
+			break;
+
+		fill:
+			state = FILL;
+		case FILL:
+			for (const char *x;
+			     nfln - nheader < nfixed &&
+				     (x = recchr(buf + ibuf, nbuf - ibuf));
+			     nfln++) {
+				/* keep track of footers */
+				lrsv[nfln - nheader] = ibuf;
+				LAST(nfln - nheader) = ibuf;
+				ibuf = ++x - buf;
+			}
+			for (const char *x;
+			     nfln - nheader >= nfixed &&
+				     (x = recchr(buf + ibuf, nbuf - ibuf));
+			     ) {
+				LAST(nfln - nheader) = ibuf;
+				ibuf = ++x - buf;
+
+				if (++nfln - nheader >= nfixed + nfooter) {
+					goto beef;
+				}
+			}
+			goto over;
+
+		beef:
+			state = BEEF;
+			/* take on the reservoir */
+			MEMZCPY(rsv, 0U, zrsv, buf + lrsv[0U],
+				LAST(nfln - nheader - nfooter) - lrsv[0U]);
+			lrsv[nfixed] = LAST(nfln - nheader - nfooter);
+			for (size_t i = nfixed + 1U; i > 0; i--) {
+				lrsv[i - 1U] -= lrsv[0U];
+			}
+
+			nfxd = nfixed;
+
+			/* we need one more sample step because the
+			 * condition above that got us here goes one
+			 * step further than it should, lest we print
+			 * the ellipsis when there's exactly
+			 * nheader + nfooter lines in the buffer */
+		case BEEF:
+			for (const char *x;
+			     (x = recchr(buf + ibuf, nbuf - ibuf));
+			     ibuf = x - buf + 1U, nfln++) {
+				/* current line length */
+				const size_t y =
+					LAST(nfln - nheader - nfooter + 1U) -
+					LAST(nfln - nheader - nfooter + 0U);
+
+				/* keep track of footers */
+				LAST(nfln - nheader) = ibuf;
+
+				if (nfln - nheader >= 4U * nfixed) {
+					/* switch to gap sampling */
+					goto bexp;
+				}
+
+				/* keep with probability nfixed / nfln */
+				if (runifu32b(nfln - nheader) >= nfixed) {
+					continue;
+				}
+
+				if (UNLIKELY(nfxd >= mult * nfixed)) {
+					/* condense lrsv */
+					compactify(lrsv, nfxd, nfixed);
+					nfxd = nfixed;
+				}
+
+				/* bang this line */
+				MEMZCPY(rsv, lrsv[nfxd], zrsv,
+					buf + LAST(nfln - nheader - nfooter), y);
+				/* and memorise him */
+				lrsv[nfxd + 1U] = lrsv[nfxd] + y;
+				nfxd++;
+			}
+			goto over;
+
+		bexp:
+			gap = nfln - nheader +
+				rexp32(nfln - nheader - nfixed, nfln);
+			state = BEXP;
+		case BEXP:
+			for (const char *x;
+			     nfln - nheader < gap &&
+				     (x = recchr(buf + ibuf, nbuf - ibuf));
+			     ibuf = x - buf + 1U, nfln++) {
+				/* every line could be our last, so keep
+				 * track of them */
+				LAST(nfln - nheader) = ibuf;
+			}
+			for (const char *x;
+			     nfln - nheader >= gap &&
+				     (x = recchr(buf + ibuf, nbuf - ibuf));
+				) {
+				/* current line length */
+				const size_t y =
+					LAST(nfln - nheader - nfooter + 1U) -
+					LAST(nfln - nheader - nfooter + 0U);
+
+				/* keep track of footers */
+				LAST(nfln - nheader) = ibuf;
+
+				if (UNLIKELY(nfxd >= mult * nfixed)) {
+					/* condense lrsv */
+					compactify(lrsv, nfxd, nfixed);
+					nfxd = nfixed;
+				}
+
+				/* bang this line */
+				MEMZCPY(rsv, lrsv[nfxd], zrsv,
+					buf +  LAST(nfln - nheader - nfooter), y);
+				/* and memorise him */
+				lrsv[nfxd + 1U] = lrsv[nfxd] + y;
+				nfxd++;
+
+				ibuf = x - buf + 1U;
+				nfln++;
+				goto bexp;
+			}
+			goto over;
+
+		over:
+			/* beef buffer overrun */
+			with (const size_t frst = FIRST(nfln - nheader)) {
+				if (LIKELY(nbuf < zbuf / 2U)) {
+					/* just read more stuff */
+					break;
+				} else if (UNLIKELY(!frst || frst == ibuf ||
+						    nfln - nheader <=
 						    nfixed + nfooter)) {
 					/* resize and retry */
 					const size_t nuz = zbuf * 2U;
 					char *tmp = realloc(buf, nuz);
 
-					if (UNLIKELY(tmp == NULL)) {
-						return -1;
-					}
-					/* otherwise assign and retry */
-					buf = tmp;
-					zbuf = nuz;
+					if (UNLIKELY(tmp == NULL)) {
+						return -1;
+					}
+					/* otherwise assign and retry */
+					buf = tmp;
+					zbuf = nuz;
+					break;
+				}
+				memmove(buf, buf + frst, nbuf - frst);
+				for (size_t i = 0U,
+					     n = min_z(nfooter + 1U,
+						       nfln - nheader);
+				     i < n; i++) {
+					last[i] -= frst;
+				}
+				nbuf -= frst;
+				ibuf -= frst;
+			}
+			/* keep track of last footer */
+			LAST(nfln - nheader) = ibuf;
+			break;
+		}
+	}
+	if (nfln >= nheader + nfixed + nfooter) {
+		const size_t beg = LAST(nfln - nheader - nfooter - 0U);
+		const size_t end = LAST(nfln - nheader - nfooter - 1U);
+
+		if (nfln > nheader + nfixed + nfooter) {
+			if (!(quietp & QUIET_LEAD)) {
+				wr(ell, nell);
+			}
+		}
+		/* compactify to obtain the final result */
+		rsv_wr(lrsv, nfxd, nfixed);
+		if (nfln > nheader + nfixed + nfooter) {
+			if (!(quietp & QUIET_TRAIL)) {
+				wr(ell, nell);
+			}
+		}
+		wr(buf + beg, end - beg);
+	} else if (nfln > nheader + nfooter) {
+		const size_t beg = lrsv[0U];
+		const size_t end = LAST(nfln - nheader - nfooter - 1U);
+		unord_wr(buf + beg, end - beg, nfln - nheader - nfooter);
+	} else if (nfln > nheader) {
+		const size_t beg = last[0U];
+		const size_t end = last[nfln - nheader];
+		wr(buf + beg, end - beg);
+	}
+	if (last != _last) {
+		free(last);
+	}
+	if (lrsv != _lrsv) {
+		free(lrsv);
+	}
+	nrec = nfln;
+	return 0;
+}
+
+static int
+sample_rsv_1f(int fd)
+{
+/* generic sampler */
+	/* number of lines read so far */
+	size_t nfln = 0U;
+	/* fill of BUF, also used as offset of end-of-header in HDR mode */
+	size_t nbuf = 0U;
+	/* index into BUF to the beginning of the last unprocessed line */
+	size_t ibuf = 0U;
+	/* skip up to this line */
+	size_t gap = 0U;
+	/* nfixed buffer oversampling */
+	size_t nfxd = 0U;
+	/* number of octets read per read() */
+	ssize_t nrd;
+	/* offsets to footer */
+	size_t last;
+	/* reservoir lines
+	 * we store offsets into RSV buffer in LRSV, which is 3 times the
+	 * size of NFIXED to concentrate the memmove()ing
+	 * the kill count for each cell is stored in LGAP */
+	size_t _lrsv[stklmt / 3U];
+	size_t *lrsv = _lrsv;
+	const size_t mult = 4U;
+	/* 3 major states, HEAD BEEF/CAKE and TAIL */
+	enum {
+		EVAL,
+		HEAD,
+		BEEF,
+		FILL,
+		BEXP,
+	} state = EVAL;
+
+	with (char *tmp = realloc(buf, BUFSIZ)) {
+		if (UNLIKELY(tmp == NULL)) {
+			/* just bugger off */
+			return -1;
+		}
+		/* otherwise swap ptrs */
+		buf = tmp;
+		zbuf = BUFSIZ;
+	}
+	with (char *tmp = realloc(rsv, BUFSIZ)) {
+		if (UNLIKELY(tmp == NULL)) {
+			/* just bugger off */
+			return -1;
+		}
+		/* otherwise swap ptrs */
+		rsv = tmp;
+		zrsv = BUFSIZ;
+	}
+	if (mult * nfixed >= countof(_lrsv)) {
+		/* do her with heap space */
+		lrsv = malloc((mult * nfixed + 1U) * sizeof(*lrsv));
+	}
+
+	/* deal with header */
+	while ((nrd = rd(fd, buf + nbuf, zbuf - nbuf)) > 0) {
+		/* calc next round's NBUF already */
+		nbuf += nrd;
+
+		switch (state) {
+		case EVAL:
+			if (!nheader) {
+				goto fill;
+			}
+			/* otherwise let HEAD state decide */
+			state = HEAD;
+		case HEAD:
+			for (const char *x;
+			     (x = recchr(buf + ibuf, nbuf - ibuf));) {
+				const size_t o = ibuf;
+
+				ibuf = ++x - buf;
+				wr(buf + o, ibuf - o);
+
+				if (++nfln >= nheader) {
+					if (UNLIKELY(!nfixed)) {
+						/* that's it */
+						return 0;
+					}
+					/* otherwise the most generic mode */
+					goto fill;
+				}
+			}
+			goto wrap;
+
+		wrap:
+			if (LIKELY(nbuf < zbuf / 2U)) {
+				/* no need for buffer juggling */
+				break;
+			} else 	if (UNLIKELY(!ibuf)) {
+				/* great, try a resize */
+				const size_t nuz = zbuf * 2U;
+				char *tmp = realloc(buf, nuz);
+
+				if (UNLIKELY(tmp == NULL)) {
+					return -1;
+				}
+				/* otherwise assign and retry */
+				buf = tmp;
+				zbuf = nuz;
+			} else if (LIKELY(ibuf < nbuf)) {
+				memmove(buf, buf + ibuf, nbuf - ibuf);
+				nbuf -= ibuf;
+				ibuf = 0U;
+			}
+			break;
+
+		fill:
+			state = FILL;
+		case FILL:
+			for (const char *x;
+			     nfln - nheader < nfixed &&
+				     (x = recchr(buf + ibuf, nbuf - ibuf));
+			     nfln++) {
+				/* keep track of footers */
+				lrsv[nfln - nheader] = ibuf;
+				last = ibuf;
+				ibuf = ++x - buf;
+			}
+			for (const char *x;
+			     nfln - nheader >= nfixed &&
+				     (x = recchr(buf + ibuf, nbuf - ibuf));
+			     ) {
+				last = ibuf;
+				ibuf = ++x - buf;
+
+				if (++nfln - nheader >= nfixed + 1U) {
+					goto beef;
+				}
+			}
+			goto over;
+
+		beef:
+			state = BEEF;
+			/* take on the reservoir */
+			MEMZCPY(rsv, 0U, zrsv, buf + lrsv[0U], last - lrsv[0U]);
+			lrsv[nfixed] = last;
+			for (size_t i = nfixed + 1U; i > 0; i--) {
+				lrsv[i - 1U] -= lrsv[0U];
+			}
+
+			nfxd = nfixed;
+
+			/* we need one more sample step because the
+			 * condition above that got us here goes one
+			 * step further than it should, lest we print
+			 * the ellipsis when there's exactly
+			 * nheader + nfooter lines in the buffer */
+		case BEEF:
+			for (const char *x;
+			     (x = recchr(buf + ibuf, nbuf - ibuf));
+			     ibuf = x - buf + 1U, nfln++) {
+				/* current line length */
+				const size_t beg = last;
+				const size_t end = ibuf;
+
+				if (nfln - nheader >= 4U * nfixed) {
+					/* switch to gap sampling, which will
+					 * revisit this line */
+					goto bexp;
+				}
+
+				/* keep track of footers */
+				last = ibuf;
+
+				/* keep with probability nfixed / nfln */
+				if (runifu32b(nfln - nheader) >= nfixed) {
+					continue;
+				}
+
+				if (UNLIKELY(nfxd >= mult * nfixed)) {
+					/* condense lrsv */
+					compactify(lrsv, nfxd, nfixed);
+					nfxd = nfixed;
+				}
+
+				/* bang this line */
+				MEMZCPY(rsv, lrsv[nfxd], zrsv, buf + beg, end - beg);
+				/* and memorise him */
+				lrsv[nfxd + 1U] = lrsv[nfxd] + end - beg;
+				nfxd++;
+			}
+			goto over;
+
+		bexp:
+			gap = nfln - nheader +
+				rexp32(nfln - nheader - nfixed, nfln);
+			state = BEXP;
+		case BEXP:
+			for (const char *x;
+			     nfln - nheader < gap &&
+				     (x = recchr(buf + ibuf, nbuf - ibuf));
+			     ibuf = x - buf + 1U, nfln++) {
+				/* every line could be our last, so keep
+				 * track of them */
+				last = ibuf;
+			}
+			for (const char *x;
+			     nfln - nheader >= gap &&
+				     (x = recchr(buf + ibuf, nbuf - ibuf));
+				) {
+				/* current line length */
+				const size_t beg = last;
+				const size_t end = ibuf;
+
+				/* keep track of footers */
+				last = ibuf;
+
+				if (UNLIKELY(nfxd >= mult * nfixed)) {
+					/* condense lrsv */
+					compactify(lrsv, nfxd, nfixed);
+					nfxd = nfixed;
+				}
+
+				/* bang this line */
+				MEMZCPY(rsv, lrsv[nfxd], zrsv, buf + beg, end - beg);
+				/* and memorise him */
+				lrsv[nfxd + 1U] = lrsv[nfxd] + end - beg;
+				nfxd++;
+
+				ibuf = x - buf + 1U;
+				nfln++;
+				goto bexp;
+			}
+			goto over;
+
+		over:
+			/* beef buffer overrun */
+			with (const size_t frst = last) {
+				if (LIKELY(nbuf < zbuf / 2U)) {
+					/* just read more stuff */
+					break;
+				} else if (UNLIKELY(!frst || frst == ibuf ||
+						    nfln - nheader <= nfixed + 1U)) {
+					/* resize and retry */
+					const size_t nuz = zbuf * 2U;
+					char *tmp = realloc(buf, nuz);
+
+					if (UNLIKELY(tmp == NULL)) {
+						return -1;
+					}
+					/* otherwise assign and retry */
+					buf = tmp;
+					zbuf = nuz;
+					break;
+				}
+				memmove(buf, buf + frst, nbuf - frst);
+				nbuf -= frst;
+				ibuf -= frst;
+				last = 0U;
+			}
+			break;
+		}
+	}
+	if (nfln >= nheader + nfixed + 1U) {
+		const size_t beg = last;
+		const size_t end = nbuf;
+
+		if (nfln > nheader + nfixed + 1U) {
+			if (!(quietp & QUIET_LEAD)) {
+				wr(ell, nell);
+			}
+		}
+		/* compactify to obtain the final result */
+		rsv_wr(lrsv, nfxd, nfixed);
+		if (nfln > nheader + nfixed + 1U) {
+			if (!(quietp & QUIET_TRAIL)) {
+				wr(ell, nell);
+			}
+		}
+		wr(buf + beg, end - beg);
+	} else if (nfln > nheader + 1U) {
+		const size_t beg = lrsv[0U];
+		const size_t end = nbuf;
+		unord_wr(buf + beg, end - beg, nfln - nheader - 1U);
+	} else if (nfln > nheader) {
+		const size_t beg = last;
+		const size_t end = nbuf;
+		wr(buf + beg, end - beg);
+	}
+	if (lrsv != _lrsv) {
+		free(lrsv);
+	}
+	nrec = nfln;
+	return 0;
+}
+
+static int
+sample_rsv_0f(int fd)
+{
+/* generic sampler */
+	/* number of lines read so far */
+	size_t nfln = 0U;
+	/* fill of BUF, also used as offset of end-of-header in HDR mode */
+	size_t nbuf = 0U;
+	/* index into BUF to the beginning of the last unprocessed line */
+	size_t ibuf = 0U;
+	/* skip up to this line */
+	size_t gap = 0U;
+	/* nfixed buffer oversampling */
+	size_t nfxd = 0U;
+	/* number of octets read per read() */
+	ssize_t nrd;
+	/* reservoir lines
+	 * we store offsets into RSV buffer in LRSV, which is 3 times the
+	 * size of NFIXED to concentrate the memmove()ing */
+	size_t _lrsv[stklmt / 2U];
+	size_t *lrsv = _lrsv;
+	const size_t mult = 4U;
+	/* major states */
+	enum {
+		EVAL,
+		HEAD,
+		BEEF,
+		FILL,
+		BEXP,
+	} state = EVAL;
+
+	with (char *tmp = realloc(buf, BUFSIZ)) {
+		if (UNLIKELY(tmp == NULL)) {
+			/* just bugger off */
+			return -1;
+		}
+		/* otherwise swap ptrs */
+		buf = tmp;
+		zbuf = BUFSIZ;
+	}
+	with (char *tmp = realloc(rsv, BUFSIZ)) {
+		if (UNLIKELY(tmp == NULL)) {
+			/* just bugger off */
+			return -1;
+		}
+		/* otherwise swap ptrs */
+		rsv = tmp;
+		zrsv = BUFSIZ;
+	}
+	if (mult * nfixed >= countof(_lrsv)) {
+		/* do her with heap space */
+		lrsv = malloc((mult * nfixed + 1U) * sizeof(*lrsv));
+	}
+
+	/* deal with header */
+	while ((nrd = rd(fd, buf + nbuf, zbuf - nbuf)) > 0) {
+		/* calc next round's NBUF already */
+		nbuf += nrd;
+
+		switch (state) {
+		case EVAL:
+			if (!nheader) {
+				goto fill;
+			}
+			/* otherwise let HEAD state decide */
+			state = HEAD;
+		case HEAD:
+			for (const char *x;
+			     (x = recchr(buf + ibuf, nbuf - ibuf));) {
+				const size_t o = ibuf;
+
+				ibuf = ++x - buf;
+				wr(buf + o, ibuf - o);
+
+				if (++nfln >= nheader) {
+					if (UNLIKELY(!nfixed)) {
+						/* that's it */
+						return 0;
+					}
+					/* otherwise the most generic mode */
+					goto fill;
+				}
+			}
+			goto wrap;
+
+		wrap:
+			if (LIKELY(nbuf < zbuf / 2U)) {
+				/* just read some more */
+				break;
+			} else if (UNLIKELY(!ibuf)) {
+				/* great, try a resize */
+				const size_t nuz = zbuf * 2U;
+				char *tmp = realloc(buf, nuz);
+
+				if (UNLIKELY(tmp == NULL)) {
+					return -1;
+				}
+				/* otherwise assign and retry */
+				buf = tmp;
+				zbuf = nuz;
+			} else if (LIKELY(ibuf < nbuf)) {
+				memmove(buf, buf + ibuf, nbuf - ibuf);
+				nbuf -= ibuf;
+				ibuf = 0U;
+			}
+			break;
+
+		fill:
+			state = FILL;
+		case FILL:
+			for (const char *x;
+			     (x = recchr(buf + ibuf, nbuf - ibuf));) {
+				/* keep track of lines */
+				lrsv[nfln - nheader] = ibuf;
+				nfln++;
+				ibuf = ++x - buf;
+
+				if (nfln - nheader >= nfixed) {
+					goto beef;
+				}
+			}
+			goto over;
+
+		beef:
+			state = BEEF;
+			/* take on the reservoir */
+			MEMZCPY(rsv, 0U, zrsv, buf + lrsv[0U], ibuf - lrsv[0U]);
+			lrsv[nfixed] = ibuf;
+			for (size_t i = nfixed + 1U; i > 0; i--) {
+				lrsv[i - 1U] -= lrsv[0U];
+			}
+
+			nfxd = nfixed;
+
+			/* we need one more sample step because the
+			 * condition above that got us here goes one
+			 * step further than it should, lest we print
+			 * the ellipsis when there's exactly
+			 * nheader + nfoooter lines in the buffer */
+		case BEEF:
+			for (const char *x;
+			     (x = recchr(buf + ibuf, nbuf - ibuf));
+			     ibuf = x - buf + 1U, nfln++) {
+				/* current line length */
+				const size_t y = x - buf + 1U - ibuf;
+
+				if (nfln - nheader >= 4U * nfixed) {
+					/* switch to gap sampling */
+					goto bexp;
+				}
+
+				/* keep with probability nfixed / nfln */
+				if (runifu32b(nfln - nheader) >= nfixed) {
+					continue;
+				}
+
+				if (UNLIKELY(nfxd >= mult * nfixed)) {
+					/* condense lrsv */
+					compactify(lrsv, nfxd, nfixed);
+					nfxd = nfixed;
+				}
+
+				/* bang this line */
+				MEMZCPY(rsv, lrsv[nfxd], zrsv, buf + ibuf, y);
+				/* and memorise him */
+				lrsv[nfxd + 1U] = lrsv[nfxd] + y;
+				nfxd++;
+			}
+			goto over;
+
+		bexp:
+			gap = nfln - nheader +
+				rexp32(nfln - nheader - nfixed, nfln);
+			state = BEXP;
+		case BEXP:
+			for (const char *x;
+			     nfln - nheader < gap &&
+				     (x = recchr(buf + ibuf, nbuf - ibuf));
+			     ibuf = x - buf + 1U, nfln++);
+			for (const char *x;
+			     nfln - nheader >= gap &&
+				     (x = recchr(buf + ibuf, nbuf - ibuf));
+				) {
+				/* current line length */
+				const size_t y = x - buf + 1U - ibuf;
+
+				if (UNLIKELY(nfxd >= mult * nfixed)) {
+					/* condense lrsv */
+					compactify(lrsv, nfxd, nfixed);
+					nfxd = nfixed;
+				}
+
+				/* bang this line */
+				MEMZCPY(rsv, lrsv[nfxd], zrsv, buf + ibuf, y);
+				/* and memorise him */
+				lrsv[nfxd + 1U] = lrsv[nfxd] + y;
+				nfxd++;
+
+				ibuf = x - buf + 1U;
+				nfln++;
+				goto bexp;
+			}
+			goto over;
+
+		over:
+			/* beef buffer overrun */
+			if (LIKELY(nbuf < zbuf / 2U)) {
+				/* we'll risk reading some more */
+				break;
+			} else if (UNLIKELY(!ibuf || nfln - nheader <= nfixed)) {
+				/* resize and retry */
+				const size_t nuz = zbuf * 2U;
+				char *tmp = realloc(buf, nuz);
+
+				if (UNLIKELY(tmp == NULL)) {
+					return -1;
+				}
+				/* otherwise assign and retry */
+				buf = tmp;
+				zbuf = nuz;
+				break;
+			}
+			memmove(buf, buf + ibuf, nbuf - ibuf);
+			nbuf -= ibuf;
+			ibuf -= ibuf;
+			break;
+		}
+	}
+	if (nfln > nheader + nfixed) {
+		if (!(quietp & QUIET_LEAD)) {
+			wr(ell, nell);
+		}
+		/* compactify to obtain the final result */
+		rsv_wr(lrsv, nfxd, nfixed);
+		if (!(quietp & QUIET_TRAIL)) {
+			wr(ell, nell);
+		}
+	} else if (nfln == nheader + nfixed) {
+		/* we ran 0 steps through beef */
+		rsv_wr(lrsv, nfixed, nfixed);
+	} else if (ibuf > lrsv[0U]) {
+		unord_wr(buf + lrsv[0U], ibuf - lrsv[0U], nfln - nheader);
+	}
+	if (lrsv != _lrsv) {
+		free(lrsv);
+	}
+	nrec = nfln;
+	return 0;
+}
+
+/* records kept aside by the samplers below, their bytes live in one
+ * arena, DKRA of which are taken up by records that were replaced */
+struct krec {
+	size_t seq;
+	size_t off;
+	size_t len;
+};
+static char *kra;
+static size_t nkra;
+static size_t zkra;
+static size_t dkra;
+
+static int
+krec_cmp(const void *x, const void *y)
+{
+	const struct krec *a = x, *b = y;
+	return (a->seq > b->seq) - (a->seq < b->seq);
+}
+
+static int
+kra_put(struct krec *r, size_t seq, const char *s, size_t n)
+{
+/* copy record S of size N with sequence number SEQ to the arena and
+ * have R point to it, whatever R pointed to before is dead now */
+	if (UNLIKELY(nkra + n > zkra)) {
+		size_t nuz = zkra ? zkra * 2U : BUFSIZ;
+		char *tmp;
+
+		for (; nkra + n > nuz; nuz *= 2U);
+		if (UNLIKELY((tmp = realloc(kra, nuz)) == NULL)) {
+			return -1;
+		}
+		kra = tmp;
+		zkra = nuz;
+	}
+	memcpy(kra + nkra, s, n);
+	dkra += r->len;
+	*r = (struct krec){seq, nkra, n};
+	nkra += n;
+	return 0;
+}
+
+static int
+kra_gc(struct krec *r, size_t nr)
+{
+/* move the records R of size NR, which must be all live records,
+ * to a fresh arena once at least half of the current one is dead */
+	char *tmp;
+	size_t o = 0U, z = zkra;
+
+	if (LIKELY(dkra < nkra / 2U || nkra < BUFSIZ)) {
+		return 0;
+	}
+	/* size the new arena after what's actually live */
+	for (size_t i = 0U; i < nr; i++) {
+		o += r[i].len;
+	}
+	for (; z < o; z *= 2U);
+	if (UNLIKELY((tmp = malloc(z)) == NULL)) {
+		return -1;
+	}
+	o = 0U;
+	for (size_t i = 0U; i < nr; i++) {
+		memcpy(tmp + o, kra + r[i].off, r[i].len);
+		r[i].off = o;
+		o += r[i].len;
+	}
+	free(kra);
+	kra = tmp;
+	zkra = z;
+	nkra = o;
+	dkra = 0U;
+	return 0;
+}
+
+static size_t
+runifz(size_t n)
+{
+/* uniform on [0, N) */
+	if (n <= UINT32_MAX) {
+		return runifu32b((uint32_t)n);
+	}
+	return runifu64() % n;
+}
+
+static void
+shuf_wr(const char *base, struct krec *r, size_t nr)
+{
+/* write records R of size NR, relative to BASE, in random order */
+	for (size_t i = nr; i > 0U; i--) {
+		const size_t j = runifz(i);
+		const struct krec t = r[j];
+
+		wr(base + t.off, t.len);
+		r[j] = r[i - 1U];
+	}
+	return;
+}
+
+static void
+kra_wr(struct krec *r, size_t nr)
+{
+/* write records R of size NR in input order, or in random order for
+ * --unordered, empty ones are skipped */
+	if (unordp) {
+		shuf_wr(kra, r, nr);
+		nkra = dkra = 0U;
+		return;
+	}
+	qsort(r, nr, sizeof(*r), krec_cmp);
+	for (size_t i = 0U; i < nr; i++) {
+		wr(kra + r[i].off, r[i].len);
+	}
+	nkra = dkra = 0U;
+}
+
+/* stratified sampling, by field SFLD, each stratum has NFIXED slots
+ * in SREC, strata are found through the open-addressed STAB */
+static size_t sfld;
+static struct stratum {
+	uint64_t h;
+	size_t key;
+	size_t nkey;
+	/* records seen so far */
+	size_t n;
+} *strata;
+static size_t nstrata;
+static size_t zstrata;
+static struct krec *srec;
+static size_t *stab;
+static size_t ztab;
+/* keys of all strata */
+static char *skey;
+static size_t nskey;
+static size_t zskey;
+
+static int
+strat_grow(void)
+{
+/* double the strata, their slots and the table */
+	const size_t nuz = zstrata ? zstrata * 2U : 64U;
+	struct stratum *tmps;
+	struct krec *tmpr;
+	size_t *tmpt;
+
+	if (UNLIKELY((tmps = realloc(strata, nuz * sizeof(*strata))) == NULL)) {
+		return -1;
+	}
+	strata = tmps;
+	if (UNLIKELY((tmpr = realloc(srec,
+				     nuz * nfixed * sizeof(*srec))) == NULL)) {
+		return -1;
+	}
+	srec = tmpr;
+	memset(srec + zstrata * nfixed, 0,
+	       (nuz - zstrata) * nfixed * sizeof(*srec));
+	zstrata = nuz;
+	/* keep the table at most half full */
+	if (UNLIKELY((tmpt = calloc(2U * nuz, sizeof(*stab))) == NULL)) {
+		return -1;
+	}
+	free(stab);
+	stab = tmpt;
+	ztab = 2U * nuz;
+	for (size_t i = 0U; i < nstrata; i++) {
+		size_t k = strata[i].h & (ztab - 1U);
+
+		for (; stab[k]; k = (k + 1U) & (ztab - 1U));
+		stab[k] = i + 1U;
+	}
+	return 0;
+}
+
+static ssize_t
+strat_get(const char *s, size_t n)
+{
+/* return the index of the stratum with key S of size N, new strata
+ * are added on the fly */
+	const uint64_t h = hash64(s, n);
+	size_t k;
+
+	if (UNLIKELY(nstrata >= zstrata) && strat_grow() < 0) {
+		return -1;
+	}
+	for (k = h & (ztab - 1U); stab[k]; k = (k + 1U) & (ztab - 1U)) {
+		const struct stratum *st = strata + stab[k] - 1U;
+
+		if (st->h == h && st->nkey == n &&
+		    !memcmp(skey + st->key, s, n)) {
+			return stab[k] - 1U;
+		}
+	}
+	if (UNLIKELY(nskey + n > zskey)) {
+		size_t nuz = zskey ? zskey * 2U : BUFSIZ;
+		char *tmp;
+
+		for (; nskey + n > nuz; nuz *= 2U);
+		if (UNLIKELY((tmp = realloc(skey, nuz)) == NULL)) {
+			return -1;
+		}
+		skey = tmp;
+		zskey = nuz;
+	}
+	memcpy(skey + nskey, s, n);
+	strata[nstrata] = (struct stratum){h, nskey, n, 0U};
+	nskey += n;
+	stab[k] = ++nstrata;
+	return nstrata - 1U;
+}
+
+static int
+strat_add(size_t seq, const char *s, size_t n)
+{
+/* reservoir-sample record S of size N into its stratum */
+	size_t m = recdlm(s, n);
+	const char *k = fld(s, &m, sfld);
+	struct stratum *st;
+	ssize_t i;
+	size_t j;
+
+	if (UNLIKELY((i = strat_get(k, m)) < 0)) {
+		return -1;
+	}
+	st = strata + i;
+	if (st->n < nfixed) {
+		j = st->n;
+	} else if (st->n < UINT32_MAX) {
+		j = runifu32b(st->n + 1U);
+	} else {
+		j = runifu64() % (st->n + 1U);
+	}
+	st->n++;
+	if (j >= nfixed) {
+		return 0;
+	} else if (UNLIKELY(kra_put(srec + i * nfixed + j, seq, s, n) < 0)) {
+		return -1;
+	}
+	return kra_gc(srec, nstrata * nfixed);
+}
+
+static size_t
+strat_fin(struct krec **r)
+{
+/* strata that aren't full yet have empty slots, push them aside */
+	size_t n = 0U;
+
+	for (size_t i = 0U; i < nstrata; i++) {
+		for (size_t j = 0U; j < min_z(strata[i].n, nfixed); j++) {
+			srec[n++] = srec[i * nfixed + j];
+		}
+	}
+	*r = srec;
+	return n;
+}
+
+static void
+strat_rst(void)
+{
+/* strata are per input */
+	if (stab != NULL) {
+		memset(srec, 0, zstrata * nfixed * sizeof(*srec));
+		memset(stab, 0, ztab * sizeof(*stab));
+	}
+	nstrata = nskey = 0U;
+}
+
+/* weighted sampling, A-ExpJ by Efraimidis and Spirakis, the kept
+ * records' keys are in WKEY, a min-heap, as logarithms */
+static size_t wfld;
+static double *wkey;
+static struct krec *wrec;
+static size_t nwrec;
+/* weight to skip before the next replacement */
+static double wjmp;
+
+static void
+wheap_swap(size_t i, size_t j)
+{
+	const double k = wkey[i];
+	const struct krec r = wrec[i];
+
+	wkey[i] = wkey[j], wrec[i] = wrec[j];
+	wkey[j] = k, wrec[j] = r;
+}
+
+static void
+wheap_up(size_t i)
+{
+	for (size_t p; i && wkey[p = (i - 1U) / 2U] > wkey[i]; i = p) {
+		wheap_swap(i, p);
+	}
+}
+
+static void
+wheap_down(size_t i)
+{
+	for (size_t c; (c = 2U * i + 1U) < nwrec; i = c) {
+		c += c + 1U < nwrec && wkey[c + 1U] < wkey[c];
+		if (wkey[i] <= wkey[c]) {
+			break;
+		}
+		wheap_swap(i, c);
+	}
+}
+
+static int
+wgt_add(size_t seq, const char *s, size_t n)
+{
+/* offer record S of size N, most of them are just jumped over */
+	const double w = fldnum(s, recdlm(s, n), wfld);
+
+	if (!(w > 0) || isinf(w)) {
+		/* can't be sampled */
+		return 0;
+	} else if (nwrec < nfixed) {
+		wkey[nwrec] = log(runifd()) / w;
+		if (UNLIKELY(kra_put(wrec + nwrec, seq, s, n) < 0)) {
+			return -1;
+		}
+		wheap_up(nwrec++);
+		if (nwrec == nfixed) {
+			wjmp = log(runifd()) / wkey[0U];
+		}
+		return 0;
+	} else if ((wjmp -= w) > 0) {
+		return 0;
+	}
+	/* S replaces the minimum, its key is drawn from above it */
+	with (const double t = exp(w * wkey[0U])) {
+		wkey[0U] = log(t + (1 - t) * runifd()) / w;
+	}
+	if (UNLIKELY(kra_put(wrec, seq, s, n) < 0)) {
+		return -1;
+	}
+	wheap_down(0U);
+	wjmp = log(runifd()) / wkey[0U];
+	return kra_gc(wrec, nwrec);
+}
+
+static size_t
+wgt_fin(struct krec **r)
+{
+	*r = wrec;
+	return nwrec;
+}
+
+static void
+wgt_rst(void)
+{
+	memset(wrec, 0, nfixed * sizeof(*wrec));
+	nwrec = 0U;
+}
+
+/* distinct sampling, a bottom-k sketch, the NFIXED smallest hashes
+ * of keys (field DFLD, 0 for the record) are in DKEY, a max-heap, the
+ * records they were first seen with in DREC, DSET has them all, too */
+static size_t dfld;
+static uint64_t *dkey;
+static struct krec *drec;
+static size_t ndrec;
+static uint64_t *dset;
+static size_t zdset;
+static uint64_t dsalt;
+
+static void
+dheap_swap(size_t i, size_t j)
+{
+	const uint64_t k = dkey[i];
+	const struct krec r = drec[i];
+
+	dkey[i] = dkey[j], drec[i] = drec[j];
+	dkey[j] = k, drec[j] = r;
+}
+
+static void
+dheap_up(size_t i)
+{
+	for (size_t p; i && dkey[p = (i - 1U) / 2U] < dkey[i]; i = p) {
+		dheap_swap(i, p);
+	}
+}
+
+static void
+dheap_down(size_t i)
+{
+	for (size_t c; (c = 2U * i + 1U) < ndrec; i = c) {
+		c += c + 1U < ndrec && dkey[c + 1U] > dkey[c];
+		if (dkey[i] >= dkey[c]) {
+			break;
+		}
+		dheap_swap(i, c);
+	}
+}
+
+static void
+u64set_del(uint64_t *set, size_t zset, uint64_t y)
+{
+/* remove Y from SET of size ZSET, see u64set_add(), and shift the
+ * rest of its cluster back so lookups still find them */
+	const unsigned int b = 64U - __builtin_ctzll(zset);
+	size_t k = (y * 0x9e3779b97f4a7c15ULL) >> b;
+
+	for (; set[k] != y; k = (k + 1U) & (zset - 1U)) {
+		if (!set[k]) {
+			return;
+		}
+	}
+	for (size_t j = k; set[j = (j + 1U) & (zset - 1U)];) {
+		const size_t h = (set[j] * 0x9e3779b97f4a7c15ULL) >> b;
+
+		/* can SET[j] move to K, i.e. is H not within (K, J] */
+		if (((j - h) & (zset - 1U)) >= ((j - k) & (zset - 1U))) {
+			set[k] = set[j];
+			k = j;
+		}
+	}
+	set[k] = 0U;
+}
+
+static int
+dst_add(size_t seq, const char *s, size_t n)
+{
+/* offer record S of size N, only new keys with small hashes stick */
+	size_t m = recdlm(s, n);
+	const char *k = dfld ? fld(s, &m, dfld) : s;
+	uint64_t h = mum64(hash64(k, m) ^ dsalt, 0x9e3779b97f4a7c15ULL);
+
+	/* 0 marks empty slots in DSET */
+	h += !h;
+	if (ndrec >= nfixed && h >= *dkey) {
+		/* the bulk of them */
+		return 0;
+	} else if (!u64set_add(dset, zdset, h)) {
+		/* seen it */
+		return 0;
+	} else if (ndrec < nfixed) {
+		dkey[ndrec] = h;
+		if (UNLIKELY(kra_put(drec + ndrec, seq, s, n) < 0)) {
+			return -1;
+		}
+		dheap_up(ndrec++);
+		return 0;
+	}
+	/* H replaces the largest hash */
+	u64set_del(dset, zdset, *dkey);
+	*dkey = h;
+	if (UNLIKELY(kra_put(drec, seq, s, n) < 0)) {
+		return -1;
+	}
+	dheap_down(0U);
+	return kra_gc(drec, ndrec);
+}
+
+static size_t
+dst_fin(struct krec **r)
+{
+	*r = drec;
+	return ndrec;
+}
+
+static void
+dst_rst(void)
+{
+	memset(drec, 0, nfixed * sizeof(*drec));
+	memset(dset, 0, zdset * sizeof(*dset));
+	ndrec = 0U;
+}
+
+/* the samplers that keep records aside, ADD is called with every
+ * record after the header, FIN hands out the kept ones */
+static const struct kops {
+	int(*add)(size_t seq, const char *s, size_t n);
+	size_t(*fin)(struct krec **r);
+	void(*rst)(void);
+} *kops;
+
+static const struct kops kops_strat = {strat_add, strat_fin, strat_rst};
+static const struct kops kops_wgt = {wgt_add, wgt_fin, wgt_rst};
+static const struct kops kops_dst = {dst_add, dst_fin, dst_rst};
+
+static int
+sample_kept(int fd)
+{
+/* sampler for records kept aside, see KOPS */
+	/* number of lines read so far */
+	size_t nfln = 0U;
+	/* fill of BUF */
+	size_t nbuf = 0U;
+	/* index into BUF to the beginning of the last unprocessed line */
+	size_t ibuf = 0U;
+	/* number of octets read per read() */
+	ssize_t nrd;
+	/* number of lines kept */
+	size_t nkept = 0U;
+	/* number of lines past the header, and of those offered */
+	size_t nbody, noff;
+	/* offsets to footer, the last NFOOTER lines are held back in BUF */
+	size_t _last[stklmt / 2U];
+	size_t *last = _last;
+	int rc = 0;
+
+	with (char *tmp = realloc(buf, BUFSIZ)) {
+		if (UNLIKELY(tmp == NULL)) {
+			/* just bugger off */
+			return -1;
+		}
+		/* otherwise swap ptrs */
+		buf = tmp;
+		zbuf = BUFSIZ;
+	}
+	if (nfooter >= countof(_last) &&
+	    UNLIKELY((last = malloc((nfooter + 1U) *
+				    sizeof(*last))) == NULL)) {
+		return -1;
+	}
+
+	while ((nrd = rd(fd, buf + nbuf, zbuf - nbuf)) > 0) {
+		/* beginning of what mustn't be discarded */
+		size_t keep;
+
+		nbuf += nrd;
+
+		for (const char *x;
+		     (x = recchr(buf + ibuf, nbuf - ibuf));) {
+			const size_t o = ibuf;
+
+			ibuf = ++x - buf;
+			if (nfln++ < nheader) {
+				wr(buf + o, ibuf - o);
+				continue;
+			}
+			/* line NBODY is held back, the one NFOOTER before
+			 * it can't be part of the footer any more */
+			nbody = nfln - nheader - 1U;
+			LAST(nbody) = o;
+			if (nbody < nfooter) {
+				continue;
+			}
+			with (const size_t beg = LAST(nbody - nfooter),
+			      end = nfooter ? LAST(nbody - nfooter + 1U) : ibuf) {
+				if (UNLIKELY(kops->add(nfln - nfooter,
+						       buf + beg,
+						       end - beg) < 0)) {
+					rc = -1;
+					goto out;
+				}
+			}
+		}
+
+		nbody = nfln - min_z(nfln, nheader);
+		keep = nbody && nfooter
+			? LAST(nbody - min_z(nbody, nfooter)) : ibuf;
+		if (LIKELY(nbuf < zbuf / 2U)) {
+			/* we've got enough buffer, use, him */
+			continue;
+		} else if (UNLIKELY(!keep)) {
+			/* great, try a resize */
+			const size_t nuz = zbuf * 2U;
+			char *tmp = realloc(buf, nuz);
+
+			if (UNLIKELY(tmp == NULL)) {
+				rc = -1;
+				goto out;
+			}
+			/* otherwise assign and retry */
+			buf = tmp;
+			zbuf = nuz;
+		} else if (LIKELY(keep < nbuf)) {
+			memmove(buf, buf + keep, nbuf - keep);
+		}
+		for (size_t i = nbody - min_z(nbody, nfooter); i < nbody; i++) {
+			LAST(i) -= keep;
+		}
+		nbuf -= keep;
+		ibuf -= keep;
+	}
+
+	nbody = nfln - min_z(nfln, nheader);
+	noff = nbody - min_z(nbody, nfooter);
+	with (struct krec *r) {
+		nkept = kops->fin(&r);
+		if (nkept < noff && !(quietp & QUIET_LEAD)) {
+			wr(ell, nell);
+		}
+		kra_wr(r, nkept);
+		if (nkept < noff && !(quietp & QUIET_TRAIL)) {
+			wr(ell, nell);
+		}
+	}
+	if (noff < nbody) {
+		/* and the footer */
+		wr(buf + LAST(noff), ibuf - LAST(noff));
+	}
+	nrec = nfln;
+out:
+	kops->rst();
+	nkra = dkra = 0U;
+	if (last != _last) {
+		free(last);
+	}
+	return rc;
+}
+
+/* replicates, NREPS independent samples in one pass, each one has
+ * its own random state in RG32 and its own output, RNX is the index
+ * of the record it takes next, so most records are one comparison */
+static size_t nreps;
+static uint64_t *rg32;
+static size_t *rnx;
+/* with -n the reservoirs, NFIXED slots each, and Algorithm L's W */
+static struct krec *rrec;
+static double *rw;
+/* --bootstrap, multiplicities are Poisson(1) */
+static int bootp;
+/* --split, cumulative shares of the outputs, times 2^32 */
+static uint64_t *scum;
+/* --shard, outputs are equally likely, with --shard-key the record's
+ * or its field SHFLD's hash decides rather than the random stream */
+static int shardp;
+static int shkeyp;
+static size_t shfld;
+
+static inline double
+reps_rate(void)
+{
+/* the rate at which replicates take records, for the bootstrap that's
+ * the chance of a non-zero multiplicity */
+	return bootp ? -expm1(-1) : (double)rate / 0x1.p32;
+}
+
+static size_t
+reps_pois(size_t j)
+{
+/* draw from Poisson(1) on the condition that it's not 0, by inversion */
+	double u = runifd_s(rg32 + j);
+	double p = exp(-1) / -expm1(-1);
+	size_t k = 1U;
+
+	for (; u > p && p > 0; u -= p, p /= (double)++k);
+	return k;
+}
+
+static size_t
+reps_skip(size_t j, size_t i, double p)
+{
+/* return the index of replicate J's next record after I, at rate P */
+	double x;
+
+	if (UNLIKELY(!(p > 0))) {
+		return SIZE_MAX;
+	}
+	x = floor(log(runifd_s(rg32 + j)) / log1p(-p));
+	return x < (double)(SIZE_MAX - i - 1U) ? i + 1U + (size_t)x : SIZE_MAX;
+}
+
+static int
+reps_add(size_t *nx, size_t i, const char *s, size_t n)
+{
+/* offer record number I (1-based, not counting the header), S of
+ * size N, to every replicate, NX is set to the next one they want */
+	const double p = reps_rate();
+
+	*nx = SIZE_MAX;
+	if (shardp) {
+		/* every record goes somewhere, all places equally likely */
+		uint64_t u;
+
+		if (shkeyp) {
+			const char *k = s;
+			size_t m = recdlm(s, n);
+
+			if (shfld) {
+				k = fld(k, &m, shfld);
+			}
+			/* remix, the top bits are --hash-sample's */
+			u = mum64(hash64(k, m), 0x9e3779b97f4a7c15ULL) >> 32U;
+		} else {
+			u = runifu32();
+		}
+		fo_wr((size_t)(u * nreps >> 32U), s, n);
+		*nx = i + 1U;
+		return 0;
+	} else if (scum != NULL) {
+		/* every record goes somewhere */
+		const uint64_t u = runifu32();
+		size_t j = 0U;
+
+		for (; j < nreps - 1U && u >= scum[j]; j++);
+		fo_wr(j, s, n);
+		*nx = i + 1U;
+		return 0;
+	} else if (!nfixed) {
+		/* Bernoulli, geometric skips */
+		for (size_t j = 0U; j < nreps; j++) {
+			if (rnx[j] == i) {
+				for (size_t m = bootp ? reps_pois(j) : 1U;
+				     m; m--) {
+					fo_wr(j, s, n);
+				}
+				rnx[j] = reps_skip(j, i, p);
+			}
+			*nx = min_z(*nx, rnx[j]);
+		}
+		return 0;
+	} else if (i <= nfixed) {
+		/* filling up, everyone has the same records, in copies
+		 * of their own, as they're let go of independently */
+		struct krec *r = rrec + i - 1U;
+
+		for (size_t j = 0U; j < nreps; j++) {
+			if (UNLIKELY(kra_put(r + j * nfixed, i, s, n) < 0)) {
+				return -1;
+			}
+		}
+		if (i < nfixed) {
+			*nx = i + 1U;
+			return 0;
+		}
+		for (size_t j = 0U; j < nreps; j++) {
+			rw[j] = exp(log(runifd_s(rg32 + j)) / (double)nfixed);
+			rnx[j] = reps_skip(j, i, rw[j]);
+			*nx = min_z(*nx, rnx[j]);
+		}
+		return 0;
+	}
+	/* Algorithm L */
+	for (size_t j = 0U; j < nreps; j++) {
+		if (rnx[j] == i) {
+			const size_t k =
+				(size_t)(runifd_s(rg32 + j) * (double)nfixed);
+
+			if (UNLIKELY(kra_put(rrec + j * nfixed + k,
+					     i, s, n) < 0)) {
+				return -1;
+			}
+			rw[j] *= exp(log(runifd_s(rg32 + j)) / (double)nfixed);
+			rnx[j] = reps_skip(j, i, rw[j]);
+		}
+		*nx = min_z(*nx, rnx[j]);
+	}
+	return kra_gc(rrec, nreps * nfixed);
+}
+
+static int
+sample_reps(int fd)
+{
+/* sampler for --replicates, the header goes to every output */
+	/* number of lines read so far */
+	size_t nfln = 0U;
+	/* fill of BUF */
+	size_t nbuf = 0U;
+	/* index into BUF to the beginning of the last unprocessed line */
+	size_t ibuf = 0U;
+	/* number of octets read per read() */
+	ssize_t nrd;
+	/* next record any of the replicates is interested in */
+	size_t nx = 1U;
+	int rc = 0;
+
+	with (char *tmp = realloc(buf, BUFSIZ)) {
+		if (UNLIKELY(tmp == NULL)) {
+			/* just bugger off */
+			return -1;
+		}
+		/* otherwise swap ptrs */
+		buf = tmp;
+		zbuf = BUFSIZ;
+	}
+	if (!nfixed && scum == NULL && !shardp) {
+		const double p = reps_rate();
+
+		nx = SIZE_MAX;
+		for (size_t j = 0U; j < nreps; j++) {
+			rnx[j] = reps_skip(j, 0U, p);
+			nx = min_z(nx, rnx[j]);
+		}
+	}
+
+	while ((nrd = rd(fd, buf + nbuf, zbuf - nbuf)) > 0) {
+		nbuf += nrd;
+
+		for (const char *x;
+		     (x = recchr(buf + ibuf, nbuf - ibuf));) {
+			const size_t o = ibuf;
+
+			ibuf = ++x - buf;
+			if (nfln++ < nheader) {
+				for (size_t j = 0U; j < nreps; j++) {
+					fo_wr(j, buf + o, ibuf - o);
+				}
+			} else if (nfln - nheader < nx) {
+				/* no one wants this one */
+				;
+			} else if (UNLIKELY(reps_add(&nx, nfln - nheader,
+						     buf + o, ibuf - o) < 0)) {
+				rc = -1;
+				goto out;
+			}
+		}
+
+		if (LIKELY(nbuf < zbuf / 2U)) {
+			/* we've got enough buffer, use, him */
+			continue;
+		} else if (UNLIKELY(!ibuf)) {
+			/* great, try a resize */
+			const size_t nuz = zbuf * 2U;
+			char *tmp = realloc(buf, nuz);
+
+			if (UNLIKELY(tmp == NULL)) {
+				rc = -1;
+				goto out;
+			}
+			/* otherwise assign and retry */
+			buf = tmp;
+			zbuf = nuz;
+		} else if (LIKELY(ibuf < nbuf)) {
+			memmove(buf, buf + ibuf, nbuf - ibuf);
+		}
+		nbuf -= ibuf;
+		ibuf = 0U;
+	}
+
+	/* write out the reservoirs, in input order */
+	for (size_t j = 0U, m = min_z(nfln - min_z(nfln, nheader), nfixed);
+	     j < nreps && m; j++) {
+		struct krec *r = rrec + j * nfixed;
+
+		qsort(r, m, sizeof(*r), krec_cmp);
+		for (size_t k = 0U; k < m; k++) {
+			fo_wr(j, kra + r[k].off, r[k].len);
+		}
+	}
+	nrec = nfln;
+out:
+	if (rrec != NULL) {
+		memset(rrec, 0, nreps * nfixed * sizeof(*rrec));
+	}
+	nkra = dkra = 0U;
+	return rc;
+}
+
+/* --shuffle, records are kept in memory as long as they fit SHMEM,
+ * beyond that they're scattered over SHNB buckets in TMPDIR at random,
+ * every bucket is then shuffled in memory, or scattered again if it's
+ * still too big, and written in turn */
+static int shufp;
+static size_t shmem = 256U << 20U;
+static const char *tmpdir = "/tmp";
+static size_t shnb;
+#define SHBUF	(64U << 10U)
+
+struct bkt {
+	FILE *f;
+	/* octets, with framing, and records in the bucket */
+	size_t z;
+	size_t n;
+};
+
+static void
+bkt_close(struct bkt *b)
+{
+	for (size_t i = 0U; i < shnb; i++) {
+		if (b[i].f != NULL) {
+			fclose(b[i].f);
+		}
+	}
+	free(b);
+	return;
+}
+
+static struct bkt*
+bkt_open(void)
+{
+/* create SHNB empty buckets, their files vanish once closed */
+	struct bkt *b = calloc(shnb, sizeof(*b));
+	char fn[4096U];
+
+	if (UNLIKELY(b == NULL)) {
+		return NULL;
+	}
+	for (size_t i = 0U; i < shnb; i++) {
+		int fd;
+
+		snprintf(fn, sizeof(fn), "%s/sample.XXXXXX", tmpdir);
+		if (UNLIKELY((fd = mkstemp(fn)) < 0)) {
+			error("\
+Error: cannot create temporary file in `%s'", tmpdir);
+			bkt_close(b);
+			return NULL;
+		}
+		unlink(fn);
+		if (UNLIKELY((b[i].f = fdopen(fd, "w+")) == NULL)) {
+			close(fd);
+			bkt_close(b);
+			return NULL;
+		}
+		setvbuf(b[i].f, NULL, _IOFBF, SHBUF);
+	}
+	return b;
+}
+
+static int
+bkt_put(struct bkt *b, const char *s, size_t n)
+{
+/* put record S of size N into one of the buckets B, at random */
+	struct bkt *x = b + runifz(shnb);
+
+	if (UNLIKELY(fwrite(&n, sizeof(n), 1U, x->f) < 1U ||
+		     fwrite(s, sizeof(*s), n, x->f) < n)) {
+		error("\
+Error: cannot write to temporary file in `%s'", tmpdir);
+		return -1;
+	}
+	x->z += sizeof(n) + n;
+	x->n++;
+	return 0;
+}
+
+static int
+shuf_bkt(struct bkt *b)
+{
+/* shuffle the records in bucket B and write them */
+	struct krec *r = NULL;
+	char *m = NULL;
+	int rc = 0;
+
+	if (UNLIKELY(fflush(b->f) || fseeko(b->f, 0, SEEK_SET) < 0)) {
+		error("\
+Error: cannot read back temporary file in `%s'", tmpdir);
+		return -1;
+	} else if (b->z > shmem && b->n > 1U) {
+		/* scatter it some more */
+		struct bkt *c = bkt_open();
+		size_t zm = 0U;
+
+		if (UNLIKELY(c == NULL)) {
+			return -1;
+		}
+		for (size_t i = 0U, n; i < b->n; i++) {
+			if (UNLIKELY(fread(&n, sizeof(n), 1U, b->f) < 1U)) {
+				goto rderr;
+			} else if (n > zm) {
+				char *tmp = realloc(m, n);
+
+				if (UNLIKELY(tmp == NULL)) {
+					rc = -1;
 					break;
 				}
-				memmove(buf, buf + frst, nbuf - frst);
-				for (size_t i = 0U,
-					     n = min_z(nfooter + 1U,
-						       nfln - nheader);
-				     i < n; i++) {
-					last[i] -= frst;
+				m = tmp;
+				zm = n;
+			}
+			if (UNLIKELY(fread(m, sizeof(*m), n, b->f) < n)) {
+				goto rderr;
+			} else if (UNLIKELY(bkt_put(c, m, n) < 0)) {
+				rc = -1;
+				break;
+			}
+		}
+		for (size_t i = 0U; i < shnb && rc >= 0; i++) {
+			rc = shuf_bkt(c + i);
+		}
+		bkt_close(c);
+		free(m);
+		return rc;
+	} else if (UNLIKELY((m = malloc(b->z)) == NULL ||
+			    (r = malloc(b->n * sizeof(*r))) == NULL)) {
+		rc = -1;
+		goto out;
+	} else if (UNLIKELY(fread(m, sizeof(*m), b->z, b->f) < b->z)) {
+		goto rderr;
+	}
+	for (size_t i = 0U, o = 0U; i < b->n; i++) {
+		size_t n;
+
+		memcpy(&n, m + o, sizeof(n));
+		o += sizeof(n);
+		r[i] = (struct krec){i, o, n};
+		o += n;
+	}
+	shuf_wr(m, r, b->n);
+out:
+	free(r);
+	free(m);
+	return rc;
+
+rderr:
+	error("\
+Error: cannot read back temporary file in `%s'", tmpdir);
+	rc = -1;
+	goto out;
+}
+
+static int
+sample_shuf(int fd)
+{
+/* sampler for --shuffle, the header stays on top */
+	/* number of lines read so far */
+	size_t nfln = 0U;
+	/* fill of BUF */
+	size_t nbuf = 0U;
+	/* index into BUF to the beginning of the last unprocessed line */
+	size_t ibuf = 0U;
+	/* number of octets read per read() */
+	ssize_t nrd;
+	/* records held in memory, and the buckets once they don't fit */
+	struct krec *r = NULL;
+	size_t nr = 0U, zr = 0U;
+	struct bkt *b = NULL;
+	int rc = 0;
+
+	with (char *tmp = realloc(buf, BUFSIZ)) {
+		if (UNLIKELY(tmp == NULL)) {
+			/* just bugger off */
+			return -1;
+		}
+		/* otherwise swap ptrs */
+		buf = tmp;
+		zbuf = BUFSIZ;
+	}
+
+	while ((nrd = rd(fd, buf + nbuf, zbuf - nbuf)) > 0) {
+		nbuf += nrd;
+
+		for (const char *x;
+		     (x = recchr(buf + ibuf, nbuf - ibuf));) {
+			const size_t o = ibuf;
+
+			ibuf = ++x - buf;
+			if (nfln++ < nheader) {
+				wr(buf + o, ibuf - o);
+				continue;
+			} else if (b != NULL) {
+				if (UNLIKELY(bkt_put(b, buf + o,
+						     ibuf - o) < 0)) {
+					rc = -1;
+					goto out;
 				}
-				nbuf -= frst;
-				ibuf -= frst;
+				continue;
+			} else if (UNLIKELY(nr >= zr)) {
+				const size_t nuz = zr ? zr * 2U : 1024U;
+				struct krec *tmp = realloc(r, nuz * sizeof(*r));
+
+				if (UNLIKELY(tmp == NULL)) {
+					rc = -1;
+					goto out;
+				}
+				r = tmp;
+				zr = nuz;
 			}
-			/* keep track of last footer */
-			LAST(nfln - nheader) = ibuf;
+			r[nr] = (struct krec){0U};
+			if (UNLIKELY(kra_put(r + nr, nr, buf + o,
+					     ibuf - o) < 0)) {
+				rc = -1;
+				goto out;
+			} else if (nkra + ++nr * sizeof(*r) <= shmem) {
+				continue;
+			} else if (UNLIKELY((b = bkt_open()) == NULL)) {
+				rc = -1;
+				goto out;
+			}
+			/* out of memory budget, spill everything */
+			for (size_t i = 0U; i < nr; i++) {
+				if (UNLIKELY(bkt_put(b, kra + r[i].off,
+						     r[i].len) < 0)) {
+					rc = -1;
+					goto out;
+				}
+			}
+			nr = 0U;
+			nkra = dkra = 0U;
+		}
+
+		if (LIKELY(nbuf < zbuf / 2U)) {
+			/* we've got enough buffer, use, him */
+			continue;
+		} else if (UNLIKELY(!ibuf)) {
+			/* great, try a resize */
+			const size_t nuz = zbuf * 2U;
+			char *tmp = realloc(buf, nuz);
+
+			if (UNLIKELY(tmp == NULL)) {
+				rc = -1;
+				goto out;
+			}
+			/* otherwise assign and retry */
+			buf = tmp;
+			zbuf = nuz;
+		} else if (LIKELY(ibuf < nbuf)) {
+			memmove(buf, buf + ibuf, nbuf - ibuf);
+		}
+		nbuf -= ibuf;
+		ibuf = 0U;
+	}
+
+	if (b == NULL) {
+		shuf_wr(kra, r, nr);
+	}
+	for (size_t i = 0U; b != NULL && i < shnb && rc >= 0; i++) {
+		rc = shuf_bkt(b + i);
+	}
+	nrec = nfln;
+out:
+	if (b != NULL) {
+		bkt_close(b);
+	}
+	free(r);
+	nkra = dkra = 0U;
+	return rc;
+}
+
+/* with --record-start a record is only terminated by the next one,
+ * so the last byte read is held back until there's more, that way
+ * the end of input (RSEND) is known when the final bytes are served */
+static ssize_t(*rsrd)(int, void*, size_t);
+static int(*rssmp)(int);
+static char rshold;
+static int rsheld;
+
+static ssize_t
+read_rs(int fd, void *b, size_t z)
+{
+	char *const p = b;
+	size_t n;
+
+	do {
+		ssize_t nrd;
+
+		n = 0U;
+		if (rsheld) {
+			p[n++] = rshold;
+			rsheld = 0;
+		}
+		if ((nrd = rsrd(fd, p + n, z - n)) < 0) {
+			return nrd;
+		} else if (!nrd) {
+			goto end;
+		}
+		n += nrd;
+		rshold = p[--n];
+		rsheld = 1;
+	} while (!n);
+	return n;
+
+end:
+	/* terminate the last line if need be */
+	if (n && p[n - 1U] != dlm[ndlm - 1U] && n + ndlm <= z) {
+		memcpy(p + n, dlm, ndlm);
+		n += ndlm;
+	}
+	rsend = n > 0U;
+	return n;
+}
+
+static int
+sample_rs(int fd)
+{
+	int rc;
+
+	rsrd = rd;
+	rsheld = rsend = 0;
+	rd = read_rs;
+	rc = rssmp(fd);
+	rd = rsrd;
+	return rc;
+}
+
+/* with --json-array the top-level elements of the array are turned
+ * into lines (compact NDJSON) as they're read, so the samplers don't
+ * need to know about JSON at all */
+static int jap;
+static ssize_t(*jard)(int, void*, size_t);
+static int(*jasmp)(int);
+static struct {
+	size_t dep;
+	unsigned int str:1;
+	unsigned int esc:1;
+	unsigned int elt:1;
+	unsigned int sep:1;
+	unsigned int end:1;
+	unsigned int err:1;
+	unsigned int eof:1;
+} ja;
+
+static size_t
+ja_str(const char *s, size_t n)
+{
+/* return the length of the prefix of S of size N without quotes and
+ * backslashes, i.e. the part of a string that needs no looking at */
+	size_t i = 0U;
+
+#if defined __SSE2__
+	const __m128i q = _mm_set1_epi8('"');
+	const __m128i b = _mm_set1_epi8('\\');
+
+	for (; i + 16U <= n; i += 16U) {
+		const __m128i x = _mm_loadu_si128((const void*)(s + i));
+		const unsigned int k = _mm_movemask_epi8(
+			_mm_or_si128(_mm_cmpeq_epi8(x, q),
+				     _mm_cmpeq_epi8(x, b)));
+
+		if (k) {
+			return i + __builtin_ctz(k);
+		}
+	}
+#endif	/* __SSE2__ */
+	for (; i < n && s[i] != '"' && s[i] != '\\'; i++);
+	return i;
+}
+
+static ssize_t
+read_ja(int fd, void *b, size_t z)
+{
+/* read from JARD and rewrite in place, whitespace outside of strings
+ * is dropped, the array's brackets, too, and commas at depth 1 become
+ * record delimiters */
+	char *const p = b;
+	size_t o;
+
+	do {
+		ssize_t nrd;
+
+		if ((nrd = jard(fd, p, z)) < 0) {
+			return nrd;
+		} else if (!nrd) {
+			goto end;
+		}
+		o = 0U;
+		for (size_t i = 0U; i < (size_t)nrd; i++) {
+			const char c = p[i];
+
+			if (ja.str) {
+				/* copy up to the next quote or backslash */
+				const size_t k =
+					ja.esc ? 0U : ja_str(p + i, nrd - i);
+
+				memmove(p + o, p + i, k);
+				o += k;
+				if ((i += k) >= (size_t)nrd) {
+					break;
+				}
+				ja.str = ja.esc || p[i] != '"';
+				ja.esc = !ja.esc && p[i] == '\\';
+				p[o++] = p[i];
+				continue;
+			}
+			switch (c) {
+			case ' ':
+			case '\t':
+			case '\n':
+			case '\r':
+				/* insignificant whitespace */
+				continue;
+			default:
+				break;
+			}
+			if (ja.end || !ja.dep && c != '[') {
+				/* only whitespace may surround the array */
+				ja.err = 1;
+				return -1;
+			} else if (!ja.dep) {
+				ja.dep = 1U;
+				continue;
+			} else if (ja.dep == 1U && (c == ',' || c == ']')) {
+				if (!ja.elt && (c == ',' || ja.sep)) {
+					/* empty elements aren't JSON */
+					ja.err = 1;
+					return -1;
+				} else if (ja.elt) {
+					p[o++] = *dlm;
+					ja.elt = 0;
+				}
+				ja.sep = c == ',';
+				ja.end = c == ']';
+				continue;
+			}
+			switch (c) {
+			case '[':
+			case '{':
+				ja.dep++;
+				break;
+			case ']':
+			case '}':
+				ja.dep--;
+				break;
+			case '"':
+				ja.str = 1;
+				break;
+			default:
+				break;
+			}
+			p[o++] = c;
+			ja.elt = 1;
+		}
+	} while (!o);
+	return o;
+
+end:
+	/* an array that's been opened but not closed is truncated */
+	ja.eof = ja.dep && !ja.end;
+	/* terminate its last element */
+	if (ja.elt && z) {
+		*p = *dlm;
+		ja.elt = 0;
+		return 1;
+	}
+	return 0;
+}
+
+static int
+sample_ja(int fd)
+{
+	int rc;
+
+	jard = rd;
+	memset(&ja, 0, sizeof(ja));
+	rd = read_ja;
+	rc = jasmp(fd);
+	rd = jard;
+	if (UNLIKELY(ja.err)) {
+		errno = 0, error("\
+Error: input is not a JSON array");
+		rc = -1;
+	} else if (UNLIKELY(ja.eof)) {
+		errno = 0, error("\
+Error: JSON array is truncated, no closing `]'");
+		rc = -1;
+	}
+	return rc;
+}
+
+/* with --record-size or --length-prefix the input must come in whole
+ * records, a partial one at the end is reported rather than dropped
+ * silently, for length prefixes FRMLEN is what's left of the current
+ * frame and FRMPFX holds the prefix of the next one so far */
+static ssize_t(*frmrd)(int, void*, size_t);
+static int(*frmsmp)(int);
+static uint64_t nfrmrd;
+static uint_fast64_t frmlen;
+static unsigned char frmpfx[10U];
+static size_t frmh;
+static int frmend;
+
+static void
+frm_len(const unsigned char *p, size_t n)
+{
+/* follow the length-prefixed frames in P of size N */
+	for (size_t i = 0U; i < n;) {
+		if (frmlen) {
+			const size_t k = frmlen < n - i ? frmlen : n - i;
+
+			i += k;
+			frmlen -= k;
+			continue;
+		}
+		frmpfx[frmh++] = p[i++];
+		switch (lpfx) {
+		case LPFX_VARINT:
+			if (frmpfx[frmh - 1U] & 0x80U) {
+				/* overlong ones go as they are, see recchr_len() */
+				frmh %= countof(frmpfx);
+				continue;
+			}
+			for (size_t k = 0U; k < frmh; k++) {
+				frmlen |= (uint_fast64_t)(frmpfx[k] & 0x7fU) <<
+					(7U * k);
+			}
+			break;
+		case LPFX_U32:
+			if (frmh < 4U) {
+				continue;
+			}
+			frmlen = (uint_fast64_t)frmpfx[0U] << 24U |
+				frmpfx[1U] << 16U | frmpfx[2U] << 8U | frmpfx[3U];
+			break;
+		default:
+			return;
+		}
+		frmh = 0U;
+	}
+	return;
+}
+
+static ssize_t
+read_frm(int fd, void *b, size_t z)
+{
+	const ssize_t nrd = frmrd(fd, b, z);
+
+	if (nrd > 0) {
+		nfrmrd += nrd;
+	}
+	if (nrd > 0 && lpfx) {
+		frm_len(b, nrd);
+	}
+	frmend |= !nrd;
+	return nrd;
+}
+
+static int
+sample_frm(int fd)
+{
+	int rc;
+
+	frmrd = rd;
+	nfrmrd = 0U;
+	frmlen = 0U;
+	frmh = 0U;
+	frmend = 0;
+	rd = read_frm;
+	rc = frmsmp(fd);
+	rd = frmrd;
+	if (!frmend) {
+		/* the sampler didn't need it all */
+		;
+	} else if (UNLIKELY(nrsz && nfrmrd % nrsz)) {
+		errno = 0, error("\
+Error: input ends in a partial record of %zu bytes",
+				 (size_t)(nfrmrd % nrsz));
+		rc = -1;
+	} else if (UNLIKELY(frmlen || frmh)) {
+		errno = 0, error("\
+Error: input ends in a truncated length-prefixed record");
+		rc = -1;
+	}
+	return rc;
+}
+
+static int(*
+sampler(void))(int)
+{
+	int(*f)(int) = sample_gen;
+
+	if (shufp) {
+		f = sample_shuf;
+	} else if (nreps) {
+		f = sample_reps;
+	} else if (kops != NULL && nfixed) {
+		f = sample_kept;
+	} else if (nfixed) {
+		switch (nfooter) {
+		case 0U:
+			f = sample_rsv_0f;
+			break;
+		case 1U:
+			f = sample_rsv_1f;
+			break;
+		default:
+			f = sample_rsv;
 			break;
 		}
+	} else if (!rate && !nfooter && !nheader) {
+		return sample_0;
+	}
+	if (rs != NULL) {
+		rssmp = f;
+		return sample_rs;
+	} else if (jap) {
+		jasmp = f;
+		return sample_ja;
+	} else if (nrsz || lpfx) {
+		frmsmp = f;
+		return sample_frm;
+	}
+	return f;
+}
+
+static int
+sample_z(int(*sample)(int), int fd, const char *fn)
+{
+/* run SAMPLE on FD, decompressing on the fly if need be */
+#if defined HAVE_ZLIB_H || defined HAVE_ZSTD_H
+	unsigned char pfx[18U];
+	size_t npfx = 0U;
+	int codec;
+	int rc;
+
+	if (sample == sample_0) {
+		return 0;
+	}
+	for (ssize_t nrd;
+	     npfx < sizeof(pfx) &&
+		     (nrd = read(fd, pfx + npfx, sizeof(pfx) - npfx)) > 0;
+	     npfx += nrd);
+	if ((codec = dec_magic(pfx, npfx)) == CODEC_NONE) {
+		/* serve what's been peeked at first */
+		slb = (const char*)pfx;
+		sln = npfx;
+		slfd = fd;
+		rd = read_slot;
+		rc = sample(fd);
+		rd = read;
+		slfd = -1;
+		sln = 0U;
+		return rc;
+	} else if (UNLIKELY(dec_start(codec, fd, (const char*)pfx, npfx) < 0)) {
+		errno = 0, error("\
+Error: cannot set up decompression for `%s'", fn);
+		return -1;
+	}
+	rd = read_dq;
+	rc = sample(fd);
+	rd = read;
+	if (UNLIKELY(dec_stop() < 0)) {
+		errno = 0, error("\
+Error: cannot decompress `%s'", fn);
+		rc = -1;
+	}
+	return rc;
+#else  /* !HAVE_ZLIB_H && !HAVE_ZSTD_H */
+	(void)fn;
+	return sample(fd);
+#endif	/* HAVE_ZLIB_H || HAVE_ZSTD_H */
+}
+
+#if defined HAVE_ZLIB_H
+/* random access into BGZF files
+ * block I starts at compressed offset BZC[I] and uncompressed offset
+ * BZU[I], the extra entry at NBZ marks the ends */
+static uint64_t *bzc;
+static uint64_t *bzu;
+static size_t nbz;
+static size_t zbz;
+/* direct-mapped cache of inflated blocks */
+#define NBZCACHE	(64U)
+static struct {
+	size_t blk;
+	size_t n;
+} bzk[NBZCACHE];
+static char *bzkbuf;
+static unsigned char *bzcbuf;
+static z_stream bzz;
+
+static const char*
+rmemchr(const char *s, int c, size_t n)
+{
+/* like memrchr() which we can't rely on */
+	for (const char *p = s + n; p-- > s;) {
+		if (*p == c) {
+			return p;
+		}
+	}
+	return NULL;
+}
+
+static int
+bz_add(uint64_t c, uint64_t u)
+{
+	if (UNLIKELY(nbz + 1U >= zbz)) {
+		const size_t nu = zbz ? 2U * zbz : 1024U;
+		uint64_t *tc, *tu;
+
+		if (UNLIKELY((tc = realloc(bzc, nu * sizeof(*bzc))) == NULL)) {
+			return -1;
+		}
+		bzc = tc;
+		if (UNLIKELY((tu = realloc(bzu, nu * sizeof(*bzu))) == NULL)) {
+			return -1;
+		}
+		bzu = tu;
+		zbz = nu;
+	}
+	bzc[nbz] = c;
+	bzu[nbz] = u;
+	nbz++;
+	return 0;
+}
+
+static int
+bz_table(int fd, const char *fn, uint64_t fz)
+{
+/* build the block table, from FN.gzi as far as it goes, the rest
+ * (or all of it) by hopping from block header to block header */
+	unsigned char b[18U];
+	uint64_t c = 0U, u = 0U;
+	int ifd;
+
+	nbz = 0U;
+	with (char ifn[strlen(fn) + 5U]) {
+		memcpy(ifn, fn, sizeof(ifn) - 5U);
+		memcpy(ifn + sizeof(ifn) - 5U, ".gzi", 5U);
+		ifd = open(ifn, O_RDONLY);
+	}
+	if (ifd >= 0) {
+		unsigned char e[16U];
+		uint64_t n = 0U;
+
+		if (read(ifd, e, 8U) == 8U) {
+			n = le64(e);
+		}
+		/* block 0 is implicit */
+		for (bz_add(0U, 0U); n-- > 0U && read(ifd, e, 16U) == 16U;) {
+			const uint64_t ec = le64(e), eu = le64(e + 8U);
+
+			if (UNLIKELY(ec <= c || eu < u || ec >= fz)) {
+				/* index doesn't fit the file, go by foot */
+				nbz = 0U;
+				c = u = 0U;
+				break;
+			} else if (UNLIKELY(bz_add(ec, eu) < 0)) {
+				close(ifd);
+				return -1;
+			}
+			c = ec;
+			u = eu;
+		}
+		close(ifd);
+		/* hop off from the last indexed block */
+		nbz -= nbz > 0U;
 	}
-	if (nfln >= nheader + nfixed + nfooter) {
-		/* compactify to obtain the final result */
-		compactify(lrsv, nfxd, nfixed);
-
-		const size_t z = lrsv[nfixed];
-		const size_t beg = LAST(nfln - nheader - nfooter - 0U);
-		const size_t end = LAST(nfln - nheader - nfooter - 1U);
+	while (c < fz) {
+		size_t bsz;
+		uint64_t isz;
 
-		if (nfln > nheader + nfixed + nfooter) {
-			if (!quietp) {
-				fwrite("...\n", 1, 4U, stdout);
-			}
+		if (UNLIKELY(pread(fd, b, sizeof(b), c) != sizeof(b) ||
+			     dec_magic(b, sizeof(b)) != CODEC_BGZF)) {
+			return -1;
 		}
-		fwrite(rsv + lrsv[0U], sizeof(*rsv), z - lrsv[0U], stdout);
-		if (nfln > nheader + nfixed + nfooter) {
-			if (!quietp) {
-				fwrite("...\n", 1, 4U, stdout);
-			}
+		bsz = (b[16U] | b[17U] << 8U) + 1U;
+		if (UNLIKELY(c + bsz > fz ||
+			     pread(fd, b, 4U, c + bsz - 4U) != 4)) {
+			return -1;
 		}
-		fwrite(buf + beg, sizeof(*buf), end - beg, stdout);
-	} else if (nfln > nheader + nfooter) {
-		const size_t beg = lrsv[0U];
-		const size_t end = LAST(nfln - nheader - nfooter - 1U);
-		fwrite(buf + beg, sizeof(*buf), end - beg, stdout);
-	} else if (nfln > nheader) {
-		const size_t beg = last[0U];
-		const size_t end = last[nfln - nheader];
-		fwrite(buf + beg, sizeof(*buf), end - beg, stdout);
+		isz = b[0U] | b[1U] << 8U | b[2U] << 16U | (uint64_t)b[3U] << 24U;
+		if (UNLIKELY(isz > BUFSIZ || bz_add(c, u) < 0)) {
+			return -1;
+		}
+		c += bsz;
+		u += isz;
 	}
-	if (last != _last) {
-		free(last);
+	/* sentinel */
+	return bz_add(c, u) < 0 || nbz < 2U ? -1 : 0;
+}
+
+static size_t
+bz_find(uint64_t x)
+{
+/* find the block containing uncompressed offset X */
+	size_t lo = 0U, hi = nbz - 1U;
+
+	while (lo + 1U < hi) {
+		const size_t mid = (lo + hi) / 2U;
+
+		if (x < bzu[mid]) {
+			hi = mid;
+		} else {
+			lo = mid;
+		}
 	}
-	if (lrsv != _lrsv) {
-		free(lrsv);
+	return lo;
+}
+
+static const char*
+bz_blk(int fd, size_t i, size_t *n)
+{
+/* return block I inflated, its size in N */
+	const size_t k = i % NBZCACHE;
+	char *ob = bzkbuf + k * BUFSIZ;
+
+	if (bzk[k].blk != i) {
+		const size_t bsz = bzc[i + 1U] - bzc[i];
+		ssize_t isz;
+
+		if (UNLIKELY(bsz > BUFSIZ ||
+			     pread(fd, bzcbuf, bsz, bzc[i]) != (ssize_t)bsz ||
+			     (isz = bgzf_inflate(&bzz, bzcbuf, bsz, ob)) < 0 ||
+			     (uint64_t)isz != bzu[i + 1U] - bzu[i])) {
+			return NULL;
+		}
+		bzk[k].blk = i;
+		bzk[k].n = isz;
 	}
-	return 0;
+	*n = bzk[k].n;
+	return ob;
 }
 
 static int
-sample_rsv_1f(int fd)
+bz_write(int fd, uint64_t from, uint64_t till)
 {
-/* generic sampler */
-	/* number of lines read so far */
-	size_t nfln = 0U;
-	/* fill of BUF, also used as offset of end-of-header in HDR mode */
-	size_t nbuf = 0U;
-	/* index into BUF to the beginning of the last unprocessed line */
-	size_t ibuf = 0U;
-	/* skip up to this line */
-	size_t gap = 0U;
-	/* nfixed buffer oversampling */
-	size_t nfxd = 0U;
-	/* number of octets read per read() */
-	ssize_t nrd;
-	/* offsets to footer */
-	size_t last;
-	/* reservoir lines
-	 * we store offsets into RSV buffer in LRSV, which is 3 times the
-	 * size of NFIXED to concentrate the memmove()ing
-	 * the kill count for each cell is stored in LGAP */
-	size_t _lrsv[stklmt / 3U];
-	size_t *lrsv = _lrsv;
-	const size_t mult = 4U;
-	/* 3 major states, HEAD BEEF/CAKE and TAIL */
-	enum {
-		EVAL,
-		HEAD,
-		BEEF,
-		FILL,
-		BEXP,
-	} state = EVAL;
+/* write uncompressed bytes [FROM, TILL) to the output */
+	for (size_t i = bz_find(from); from < till; i++) {
+		const char *b;
+		size_t n;
 
-	with (char *tmp = realloc(buf, BUFSIZ)) {
-		if (UNLIKELY(tmp == NULL)) {
-			/* just bugger off */
+		if (UNLIKELY((b = bz_blk(fd, i, &n)) == NULL)) {
 			return -1;
 		}
-		/* otherwise swap ptrs */
-		buf = tmp;
-		zbuf = BUFSIZ;
-	}
-	with (char *tmp = realloc(rsv, BUFSIZ)) {
-		if (UNLIKELY(tmp == NULL)) {
-			/* just bugger off */
-			return -1;
+		with (size_t o = from - bzu[i], e = min_z(n, till - bzu[i])) {
+			wr(b + o, e - o);
+			from = bzu[i] + e;
 		}
-		/* otherwise swap ptrs */
-		rsv = tmp;
-		zrsv = BUFSIZ;
-	}
-	if (mult * nfixed >= countof(_lrsv)) {
-		/* do her with heap space */
-		lrsv = malloc((mult * nfixed + 1U) * sizeof(*lrsv));
 	}
+	return 0;
+}
 
-	/* deal with header */
-	while ((nrd = read(fd, buf + nbuf, zbuf - nbuf)) > 0) {
-		/* calc next round's NBUF already */
-		nbuf += nrd;
+static int
+bz_lbeg(int fd, uint64_t x, uint64_t *r)
+{
+/* find the beginning of the line holding uncompressed offset X */
+	for (size_t i = bz_find(x);; i--) {
+		const char *b, *p;
+		size_t n;
 
-		switch (state) {
-		case EVAL:
-			if (!nheader) {
-				goto fill;
-			}
-			/* otherwise let HEAD state decide */
-			state = HEAD;
-		case HEAD:
-			for (const char *x;
-			     (x = memchr(buf + ibuf, '\n', nbuf - ibuf));) {
-				const size_t o = ibuf;
+		if (UNLIKELY((b = bz_blk(fd, i, &n)) == NULL)) {
+			return -1;
+		} else if ((p = rmemchr(b, *dlm, x - bzu[i]))) {
+			*r = bzu[i] + (p - b) + 1U;
+			return 0;
+		} else if (!i) {
+			*r = 0U;
+			return 0;
+		}
+		x = bzu[i];
+	}
+}
 
-				ibuf = ++x - buf;
-				fwrite(buf + o, sizeof(*buf), ibuf - o, stdout);
+static int
+sample_bgzf_pos(int fd, uint64_t hend, uint64_t fbeg, size_t maxtry,
+		uint64_t *pos)
+{
+/* draw NFIXED distinct line ends from [HEND, FBEG) into POS
+ * blocks are drawn in proportion to their (eligible) size, then
+ * accepted with a probability of their line density, i.e. lines per
+ * byte, which is bounded by 1 no matter what's in the other blocks,
+ * so a line is picked with probability proportional to
+ * size * density / size = 1, this corrects for the bias towards
+ * blocks with long lines;  give up after MAXTRY draws */
+	const size_t zset = (size_t)1U << (64U - __builtin_clzll(2U * nfixed));
+	uint64_t *set;
+	size_t npos = 0U;
+	size_t ntry = 0U;
+	int rc = 0;
 
-				if (++nfln >= nheader) {
-					if (UNLIKELY(!nfixed)) {
-						/* that's it */
-						return 0;
-					}
-					/* otherwise the most generic mode */
-					goto fill;
-				}
-			}
-			goto wrap;
+	if (UNLIKELY((set = calloc(zset, sizeof(*set))) == NULL)) {
+		return -1;
+	}
+	while (npos < nfixed) {
+		const uint64_t x = hend + runifu64() % (fbeg - hend);
+		const size_t i = bz_find(x);
+		const uint64_t lo = bzu[i] > hend ? bzu[i] : hend;
+		const uint64_t hi = bzu[i + 1U] < fbeg ? bzu[i + 1U] : fbeg;
+		const char *b, *p, *ep;
+		size_t n, m = 0U;
+
+		if (UNLIKELY(++ntry > maxtry)) {
+			/* too sparse for this */
+			rc = 1;
+			break;
+		} else if (UNLIKELY((b = bz_blk(fd, i, &n)) == NULL)) {
+			rc = -1;
+			break;
+		}
+		b += lo - bzu[i];
+		ep = b + (hi - lo);
+		for (p = b; (p = memchr(p, *dlm, ep - p)); p++, m++);
+		if (runifd() * (double)(hi - lo) >= (double)m) {
+			continue;
+		}
+		/* pick one of the M line ends uniformly */
+		p = memchr(b, *dlm, ep - b);
+		for (uint32_t j = runifu32b(m); j; j--) {
+			p = memchr(p + 1, *dlm, ep - p - 1);
+		}
+		if (u64set_add(set, zset, lo + (p - b) + 1U)) {
+			pos[npos++] = lo + (p - b);
+		}
+	}
+	free(set);
+	return rc;
+}
 
-		wrap:
-			if (LIKELY(nbuf < zbuf / 2U)) {
-				/* no need for buffer juggling */
-				break;
-			} else 	if (UNLIKELY(!ibuf)) {
-				/* great, try a resize */
-				const size_t nuz = zbuf * 2U;
-				char *tmp = realloc(buf, nuz);
+static int
+sample_bgzf(int fd, const char *fn, uint64_t fz)
+{
+/* sample NFIXED lines off BGZF file FD inflating only the blocks
+ * that are needed, return 1 if FD is better off being streamed */
+	const uint64_t og32 = g32;
+	unsigned char b[18U];
+	uint64_t *pos = NULL;
+	uint64_t hend = 0U, fbeg, u, x;
+	size_t dn = 0U, dm = 0U;
+	/* expected number of draws */
+	double ntry;
+	int rc = 1;
+
+	if (recfn != NULL || jap) {
+		/* records might straddle blocks in more than one way */
+		return 1;
+	} else if (pread(fd, b, sizeof(b), 0) != sizeof(b) ||
+		   dec_magic(b, sizeof(b)) != CODEC_BGZF) {
+		return 1;
+	}
+	memset(&bzz, 0, sizeof(bzz));
+	if (UNLIKELY(inflateInit2(&bzz, -15) != Z_OK)) {
+		return 1;
+	} else if (UNLIKELY((bzkbuf = malloc(NBZCACHE * BUFSIZ)) == NULL ||
+			    (bzcbuf = malloc(BUFSIZ)) == NULL)) {
+		goto out;
+	} else if (bz_table(fd, fn, fz) < 0) {
+		/* leave it to the streaming decoder to complain */
+		goto out;
+	} else if (!(u = bzu[nbz - 1U])) {
+		goto out;
+	}
+	for (size_t k = 0U; k < NBZCACHE; k++) {
+		bzk[k].blk = SIZE_MAX;
+	}
 
-				if (UNLIKELY(tmp == NULL)) {
-					return -1;
-				}
-				/* otherwise assign and retry */
-				buf = tmp;
-				zbuf = nuz;
-			} else if (LIKELY(ibuf < nbuf)) {
-				memmove(buf, buf + ibuf, nbuf - ibuf);
-				nbuf -= ibuf;
-				ibuf = 0U;
-			}
-			break;
+	/* get an idea of the line density */
+	for (size_t k = 0U; k < 16U; k++) {
+		const size_t i = bz_find(runifu64() % u);
+		const char *p, *ep;
+		size_t n, m = 0U;
 
-		fill:
-			state = FILL;
-		case FILL:
-			for (const char *x;
-			     nfln - nheader < nfixed &&
-				     (x = memchr(buf + ibuf, '\n', nbuf - ibuf));
-			     nfln++) {
-				/* keep track of footers */
-				lrsv[nfln - nheader] = ibuf;
-				last = ibuf;
-				ibuf = ++x - buf;
-			}
-			for (const char *x;
-			     nfln - nheader >= nfixed &&
-				     (x = memchr(buf + ibuf, '\n', nbuf - ibuf));
-			     ) {
-				last = ibuf;
-				ibuf = ++x - buf;
+		if (UNLIKELY((p = bz_blk(fd, i, &n)) == NULL)) {
+			goto out;
+		}
+		for (ep = p + n; (p = memchr(p, *dlm, ep - p)); p++, m++);
+		dn += n;
+		dm += m;
+	}
+	if ((double)u * (double)dm / (double)dn <
+	    (double)(64U * (nheader + nfixed + nfooter))) {
+		/* small enough to be streamed */
+		goto out;
+	}
 
-				if (++nfln - nheader >= nfixed + 1U) {
-					goto beef;
-				}
-			}
-			goto over;
+	/* find the end of the header ... */
+	for (size_t i = 0U, h = nheader; h; i++) {
+		const char *b0, *p, *ep;
+		size_t n;
 
-		beef:
-			state = BEEF;
-			/* take on the reservoir */
-			MEMZCPY(rsv, 0U, zrsv, buf + lrsv[0U], last - lrsv[0U]);
-			lrsv[nfixed] = last;
-			for (size_t i = nfixed + 1U; i > 0; i--) {
-				lrsv[i - 1U] -= lrsv[0U];
-			}
+		if (i + 1U >= nbz || (b0 = bz_blk(fd, i, &n)) == NULL) {
+			goto out;
+		}
+		for (p = b0, ep = b0 + n;
+		     h && (p = memchr(p, *dlm, ep - p)); p++, h--) {
+			hend = bzu[i] + (p - b0) + 1U;
+		}
+	}
+	/* ... and the beginning of the footer, the final byte is either
+	 * the footer's last line break or part of the last line */
+	fbeg = u;
+	x = u - 1U;
+	for (size_t i = bz_find(u - 1U), f = nfooter; f;) {
+		const char *b0, *p;
+		size_t n;
+
+		if ((b0 = bz_blk(fd, i, &n)) == NULL) {
+			goto out;
+		} else if ((p = rmemchr(b0, *dlm, x - bzu[i]))) {
+			x = bzu[i] + (p - b0);
+			fbeg = x + 1U;
+			f--;
+		} else if (i) {
+			x = bzu[i--];
+		} else {
+			goto out;
+		}
+	}
+	/* a draw is accepted with the odds of hitting a line end, every
+	 * draw costs a block, unless that's more than the whole file */
+	ntry = (double)nfixed * (double)dn / (double)(dm + !dm);
+	if (hend >= fbeg || !dm ||
+	    (double)(fbeg - hend) * (double)dm / (double)dn <
+	    (double)(16U * nfixed) ||
+	    ntry * (double)dn / 16 >= (double)u) {
+		goto out;
+	} else if (UNLIKELY((pos = malloc(nfixed * sizeof(*pos))) == NULL)) {
+		goto out;
+	} else if (sample_bgzf_pos(fd, hend, fbeg,
+				   (size_t)(8 * ntry) + 4096U, pos)) {
+		goto out;
+	}
+	/* keep the lines in file order */
+	qsort(pos, nfixed, sizeof(*pos), u64cmp);
 
-			nfxd = nfixed;
+	rc = bz_write(fd, 0U, hend);
+	if (!(quietp & QUIET_LEAD)) {
+		wr(ell, nell);
+	}
+	for (size_t k = 0U; k < nfixed && rc >= 0; k++) {
+		uint64_t lbeg;
 
-			/* we need one more sample step because the
-			 * condition above that got us here goes one
-			 * step further than it should, lest we print
-			 * the ellipsis when there's exactly
-			 * nheader + nfooter lines in the buffer */
-		case BEEF:
-			for (const char *x;
-			     (x = memchr(buf + ibuf, '\n', nbuf - ibuf));
-			     ibuf = x - buf + 1U, nfln++) {
-				/* current line length */
-				const size_t beg = last;
-				const size_t end = ibuf;
+		if ((rc = bz_lbeg(fd, pos[k], &lbeg)) >= 0) {
+			rc = bz_write(fd, lbeg, pos[k] + 1U);
+		}
+	}
+	if (!(quietp & QUIET_TRAIL)) {
+		wr(ell, nell);
+	}
+	if (rc >= 0) {
+		rc = bz_write(fd, fbeg, u);
+	}
+	if (UNLIKELY(rc < 0)) {
+		errno = 0, error("\
+Error: cannot decompress `%s'", fn);
+	}
+out:
+	if (rc > 0) {
+		/* as if we had never been here */
+		g32 = og32;
+	}
+	inflateEnd(&bzz);
+	free(pos);
+	free(bzkbuf);
+	free(bzcbuf);
+	free(bzc);
+	free(bzu);
+	bzkbuf = NULL;
+	bzcbuf = NULL;
+	bzc = bzu = NULL;
+	nbz = zbz = 0U;
+	return rc;
+}
+#endif	/* HAVE_ZLIB_H */
 
-				/* keep track of footers */
-				last = ibuf;
+static int
+fix_write(int fd, uint64_t i, uint64_t j, char *b)
+{
+/* write fixed-size records [I, J) of FD, using B as buffer */
+	for (; i < j; i++) {
+		if (UNLIKELY(pread(fd, b, nrsz, i * nrsz) != (ssize_t)nrsz)) {
+			return -1;
+		}
+		wr(b, nrsz);
+	}
+	return 0;
+}
 
-				if (nfln - nheader >= 4U * nfixed) {
-					/* switch to gap sampling */
-					goto bexp;
-				}
+static int
+sample_fix(int fd, const char *fn, uint64_t fz)
+{
+/* sample fixed-size records of FD by their index, only what's
+ * to be printed is read, return 1 if FD is better off being streamed */
+	const uint64_t nr = fz / nrsz;
+	const uint64_t h = nheader < nr ? nheader : nr;
+	const uint64_t f = nfooter < nr - h ? nfooter : nr - h;
+	/* eligible records are [h, h + m) */
+	const uint64_t m = nr - h - f;
+	char *b;
+	int rc = 0;
 
-				/* keep with probability nfixed / nfln */
-				if (runifu32b(nfln - nheader) >= nfixed) {
-					continue;
-				}
+#if defined HAVE_ZLIB_H || defined HAVE_ZSTD_H
+	with (unsigned char pfx[18U]) {
+		const ssize_t npfx = pread(fd, pfx, sizeof(pfx), 0);
 
-				if (UNLIKELY(nfxd >= mult * nfixed)) {
-					/* condense lrsv */
-					compactify(lrsv, nfxd, nfixed);
-					nfxd = nfixed;
-				}
+		if (npfx > 0 && dec_magic(pfx, npfx) != CODEC_NONE) {
+			return 1;
+		}
+	}
+#endif	/* HAVE_ZLIB_H || HAVE_ZSTD_H */
+	if (UNLIKELY((b = malloc(nrsz)) == NULL)) {
+		return 1;
+	}
+	rc |= fix_write(fd, 0U, h, b);
+	if (nfixed && nfixed < m) {
+		/* Floyd's algorithm for NFIXED distinct indices */
+		const size_t zset =
+			(size_t)1U << (64U - __builtin_clzll(2U * nfixed));
+		uint64_t *set = calloc(zset, sizeof(*set));
+		uint64_t *idx = malloc(nfixed * sizeof(*idx));
+		size_t k = 0U;
+
+		if (UNLIKELY(set == NULL || idx == NULL)) {
+			free(set);
+			free(idx);
+			free(b);
+			return -1;
+		}
+		for (uint64_t j = m - nfixed; j < m; j++) {
+			const uint64_t t = runifu64() % (j + 1U);
 
-				/* bang this line */
-				MEMZCPY(rsv, lrsv[nfxd], zrsv, buf + beg, end - beg);
-				/* and memorise him */
-				lrsv[nfxd + 1U] = lrsv[nfxd] + end - beg;
-				nfxd++;
+			idx[k++] = u64set_add(set, zset, t + 1U) ? t : j;
+			if (idx[k - 1U] == j) {
+				u64set_add(set, zset, j + 1U);
 			}
-			goto over;
-
-		bexp:
-			gap = nfln - nheader +
-				rexp32(nfln - nheader - nfixed, nfln);
-			state = BEXP;
-		case BEXP:
-			for (const char *x;
-			     nfln - nheader < gap &&
-				     (x = memchr(buf + ibuf, '\n', nbuf - ibuf));
-			     ibuf = x - buf + 1U, nfln++) {
-				/* every line could be our last, so keep
-				 * track of them */
-				last = ibuf;
+		}
+		free(set);
+		/* keep them in file order */
+		qsort(idx, nfixed, sizeof(*idx), u64cmp);
+		for (size_t i = 0U; i < nfixed && rc >= 0; i++) {
+			rc |= fix_write(fd, h + idx[i], h + idx[i] + 1U, b);
+		}
+		free(idx);
+	} else if (nfixed || rate > UINT32_MAX) {
+		/* everything's in */
+		rc |= fix_write(fd, h, h + m, b);
+	} else if (rate) {
+		/* geometric skips, P(skip = x) = (1 - p)^x p */
+		const double lq = log1p(-(double)rate / 0x1.p32);
+
+		for (uint64_t i = 0U; rc >= 0; i++) {
+			const double x = (double)i + floor(log(runifd()) / lq);
+
+			if (x >= (double)m) {
+				break;
 			}
-			for (const char *x;
-			     nfln - nheader >= gap &&
-				     (x = memchr(buf + ibuf, '\n', nbuf - ibuf));
-				) {
-				/* current line length */
-				const size_t beg = last;
-				const size_t end = ibuf;
-
-				/* keep track of footers */
-				last = ibuf;
+			i = (uint64_t)x;
+			rc |= fix_write(fd, h + i, h + i + 1U, b);
+		}
+	}
+	rc |= fix_write(fd, h + m, nr, b);
+	if (UNLIKELY(rc < 0)) {
+		error("\
+Error: cannot read records from `%s'", fn);
+	} else if (UNLIKELY(fz % nrsz)) {
+		errno = 0, error("\
+Error: `%s' ends in a partial record of %zu bytes",
+				 fn, (size_t)(fz % nrsz));
+		rc = -1;
+	}
+	free(b);
+	nrec = nr;
+	return rc;
+}
 
-				if (UNLIKELY(nfxd >= mult * nfixed)) {
-					/* condense lrsv */
-					compactify(lrsv, nfxd, nfixed);
-					nfxd = nfixed;
-				}
+static int
+sample(const char *fn)
+{
+	int(*sample)(int) = sampler();
+	/* whether the stock samplers are in charge */
+	const int stockp = pickfn == NULL && kops == NULL && !nreps &&
+		!shufp && !unordp && !restp;
+	struct stat st;
+	int rc = 0;
+	int fd;
 
-				/* bang this line */
-				MEMZCPY(rsv, lrsv[nfxd], zrsv, buf + beg, end - beg);
-				/* and memorise him */
-				lrsv[nfxd + 1U] = lrsv[nfxd] + end - beg;
-				nfxd++;
+	if (fn == NULL || fn[0U] == '-' && fn[1U] == '\0') {
+		/* stdin ... *sigh* */
+		fd = STDIN_FILENO;
+		return sample_z(sample, fd, "-");
+	} else if (UNLIKELY((fd = open(fn, O_RDONLY)) < 0)) {
+		error("\
+Error: cannot open file `%s'", fn);
+		return -1;
+	} else if (UNLIKELY(fstat(fd, &st) < 0)) {
+		error("\
+Error: cannot stat file `%s'", fn);
+		rc = -1;
+	} else if (!S_ISREG(st.st_mode)) {
+		/* fgetln/getline */
+		rc = sample_z(sample, fd, fn);
+	} else if (nrsz && stockp &&
+		   (rc = sample_fix(fd, fn, st.st_size)) <= 0) {
+		/* records are addressable by index */
+		;
+#if defined HAVE_ZLIB_H
+	} else if (nfixed && !lockp && stockp &&
+		   (rc = sample_bgzf(fd, fn, st.st_size)) <= 0) {
+		/* block-wise random access did the trick */
+		;
+#endif	/* HAVE_ZLIB_H */
+	} else {
+		rc = sample_z(sample, fd, fn);
+	}
 
-				ibuf = x - buf + 1U;
-				nfln++;
-				goto bexp;
-			}
-			goto over;
+	close(fd);
+	return rc;
+}
 
-		over:
-			/* beef buffer overrun */
-			with (const size_t frst = last) {
-				if (LIKELY(nbuf < zbuf / 2U)) {
-					/* just read more stuff */
-					break;
-				} else if (UNLIKELY(!frst || frst == ibuf ||
-						    nfln - nheader <= nfixed + 1U)) {
-					/* resize and retry */
-					const size_t nuz = zbuf * 2U;
-					char *tmp = realloc(buf, nuz);
+static size_t
+pair_count(const char *fn)
+{
+/* count the records in FN in a quick pass, return SIZE_MAX if FN is
+ * no regular file, is compressed or if its records need parsing */
+	char b[65536U];
+	size_t n = 0U;
+	struct stat st;
+	ssize_t nrd;
+	int fd;
 
-					if (UNLIKELY(tmp == NULL)) {
-						return -1;
-					}
-					/* otherwise assign and retry */
-					buf = tmp;
-					zbuf = nuz;
-					break;
-				}
-				memmove(buf, buf + frst, nbuf - frst);
-				nbuf -= frst;
-				ibuf -= frst;
-				last = 0U;
-			}
-			break;
+	if (recfn != NULL && !nrsz || jap) {
+		return SIZE_MAX;
+	} else if (fn == NULL || fn[0U] == '-' && fn[1U] == '\0') {
+		return SIZE_MAX;
+	} else if (UNLIKELY((fd = open(fn, O_RDONLY)) < 0)) {
+		return SIZE_MAX;
+	} else if (UNLIKELY(fstat(fd, &st) < 0) || !S_ISREG(st.st_mode)) {
+		n = SIZE_MAX;
+		goto out;
+	}
+	for (off_t o = 0; (nrd = read(fd, b, sizeof(b))) > 0; o += nrd) {
+#if defined HAVE_ZLIB_H || defined HAVE_ZSTD_H
+		if (!o && dec_magic((const unsigned char*)b, nrd) != CODEC_NONE) {
+			n = SIZE_MAX;
+			goto out;
+		}
+#endif	/* HAVE_ZLIB_H || HAVE_ZSTD_H */
+		if (nrsz) {
+			/* the size will do */
+			n = st.st_size / nrsz;
+			goto out;
 		}
+		for (const char *p = b, *const ep = b + nrd;
+		     (p = memchr(p, *dlm, ep - p)); p++, n++);
 	}
-	if (nfln >= nheader + nfixed + 1U) {
-		/* compactify to obtain the final result */
-		compactify(lrsv, nfxd, nfixed);
+	if (UNLIKELY(nrd < 0)) {
+		n = SIZE_MAX;
+	}
+out:
+	close(fd);
+	return n;
+}
 
-		const size_t z = lrsv[nfixed];
-		const size_t beg = last;
-		const size_t end = nbuf;
+static int
+sample_paired(char *const *fns, size_t nfns, char *const *outs, size_t nouts)
+{
+/* sample FNS in lockstep, every file gets the same random numbers so
+ * as long as their record counts agree so do the decisions */
+	const uint64_t og32 = g32;
+	size_t n = SIZE_MAX;
+	size_t m;
+	int rc = 0;
 
-		if (nfln > nheader + nfixed + 1U) {
-			if (!quietp) {
-				fwrite("...\n", 1, 4U, stdout);
+	if (nfns > 1U && (m = pair_count(fns[0U])) < SIZE_MAX) {
+		/* regular files can be checked before anything is written */
+		for (size_t i = 1U; i < nfns; i++) {
+			const size_t mi = pair_count(fns[i]);
+
+			if (mi < SIZE_MAX && UNLIKELY(mi != m)) {
+				errno = 0, error("\
+Error: `%s' has %zu records, `%s' has %zu", fns[0U], m, fns[i], mi);
+				return -1;
 			}
 		}
-		fwrite(rsv + lrsv[0U], sizeof(*rsv), z - lrsv[0U], stdout);
-		if (nfln > nheader + nfixed + 1U) {
-			if (!quietp) {
-				fwrite("...\n", 1, 4U, stdout);
+	}
+	lockp = 1;
+	for (size_t i = 0U; i < nfns; i++) {
+		g32 = og32;
+		nrec = SIZE_MAX;
+		if (nouts && UNLIKELY(out_open(outs[i]) < 0)) {
+			rc = -1;
+			break;
+		} else if (!nouts && nfns > 1U) {
+			if (i) {
+				wr("\n", 1U);
 			}
+			wr("==> ", 4U);
+			wr(fns[i], strlen(fns[i]));
+			wr(" <==\n", 5U);
+		}
+		rc |= sample(fns[i]);
+		if (nouts && UNLIKELY(out_close() < 0)) {
+			error("\
+Error: cannot write to `%s'", outs[i]);
+			rc = -1;
+		}
+		if (nrec == SIZE_MAX) {
+			/* sampler bailed out early */
+			;
+		} else if (n == SIZE_MAX) {
+			n = nrec;
+		} else if (UNLIKELY(nrec != n)) {
+			errno = 0, error("\
+Error: `%s' has %zu records, `%s' has %zu", fns[0U], n, fns[i], nrec);
+			rc = -1;
 		}
-		fwrite(buf + beg, sizeof(*buf), end - beg, stdout);
-	} else if (nfln > nheader + 1U) {
-		const size_t beg = lrsv[0U];
-		const size_t end = nbuf;
-		fwrite(buf + beg, sizeof(*buf), end - beg, stdout);
-	} else if (nfln > nheader) {
-		const size_t beg = last;
-		const size_t end = nbuf;
-		fwrite(buf + beg, sizeof(*buf), end - beg, stdout);
-	}
-	if (lrsv != _lrsv) {
-		free(lrsv);
 	}
-	return 0;
+	lockp = 0;
+	return rc;
 }
 
 static int
-sample_rsv_0f(int fd)
+sample_union(char *const *fns, size_t nfns)
 {
-/* generic sampler */
-	/* number of lines read so far */
-	size_t nfln = 0U;
-	/* fill of BUF, also used as offset of end-of-header in HDR mode */
-	size_t nbuf = 0U;
-	/* index into BUF to the beginning of the last unprocessed line */
-	size_t ibuf = 0U;
-	/* skip up to this line */
-	size_t gap = 0U;
-	/* nfixed buffer oversampling */
-	size_t nfxd = 0U;
-	/* number of octets read per read() */
-	ssize_t nrd;
-	/* reservoir lines
-	 * we store offsets into RSV buffer in LRSV, which is 3 times the
-	 * size of NFIXED to concentrate the memmove()ing */
-	size_t _lrsv[stklmt / 2U];
-	size_t *lrsv = _lrsv;
-	const size_t mult = 4U;
-	/* major states */
-	enum {
-		EVAL,
-		HEAD,
-		BEEF,
-		FILL,
-		BEXP,
-	} state = EVAL;
+/* sample FNS as though they were one file */
+	int(*sample)(int) = sampler();
+	int rc;
+
+	chn = fns;
+	nchn = nfns;
+	ichn = 0U;
+	rd = read_chain;
+	rc = sample(-1);
+	/* drain the chain should the sampler have bailed out early */
+#if defined HAVE_ZLIB_H || defined HAVE_ZSTD_H
+	if (chdq) {
+		dec_stop();
+	}
+#endif	/* HAVE_ZLIB_H || HAVE_ZSTD_H */
+	chdq = 0;
+	chnpfx = 0U;
+	if (chfd > STDIN_FILENO) {
+		close(chfd);
+	}
+	if (nxfd > STDIN_FILENO) {
+		close(nxfd);
+	}
+	chfd = nxfd = -1;
+	rd = read;
+	return rc < 0 ? rc : chrc;
+}
 
-	with (char *tmp = realloc(buf, BUFSIZ)) {
-		if (UNLIKELY(tmp == NULL)) {
-			/* just bugger off */
-			return -1;
+static size_t
+tree_find(const uint64_t *cum, size_t n, uint64_t x)
+{
+/* find the smallest I with X < CUM[I] */
+	size_t lo = 0U, hi = n - 1U;
+
+	while (lo < hi) {
+		const size_t mid = (lo + hi) / 2U;
+
+		if (x < cum[mid]) {
+			hi = mid;
+		} else {
+			lo = mid + 1U;
 		}
-		/* otherwise swap ptrs */
-		buf = tmp;
-		zbuf = BUFSIZ;
 	}
-	with (char *tmp = realloc(rsv, BUFSIZ)) {
-		if (UNLIKELY(tmp == NULL)) {
-			/* just bugger off */
-			return -1;
+	return lo;
+}
+
+static double
+tree_avgll(char *const *fns, const uint64_t *cum, size_t n)
+{
+/* estimate the average line length by counting line breaks in a
+ * couple of blocks at random offsets, picked in proportion to size */
+	char b[4096U];
+	size_t nb = 0U, nl = 0U;
+
+	for (size_t i = 0U; i < 16U; i++) {
+		const uint64_t x = runifu64() % cum[n - 1U];
+		const size_t j = tree_find(cum, n, x);
+		const uint64_t o = x - (j ? cum[j - 1U] : 0U);
+		ssize_t nrd;
+		int fd;
+
+		if (UNLIKELY((fd = open(fns[j], O_RDONLY)) < 0)) {
+			continue;
+		} else if ((nrd = pread(fd, b, sizeof(b), o)) > 0) {
+			nb += nrd;
+			for (const char *p = b, *const ep = b + nrd;
+			     (p = memchr(p, *dlm, ep - p)); p++, nl++);
 		}
-		/* otherwise swap ptrs */
-		rsv = tmp;
-		zrsv = BUFSIZ;
-	}
-	if (mult * nfixed >= countof(_lrsv)) {
-		/* do her with heap space */
-		lrsv = malloc((mult * nfixed + 1U) * sizeof(*lrsv));
+		close(fd);
 	}
+	return nl ? (double)nb / (double)nl : (double)nb + 1;
+}
 
-	/* deal with header */
-	while ((nrd = read(fd, buf + nbuf, zbuf - nbuf)) > 0) {
-		/* calc next round's NBUF already */
-		nbuf += nrd;
+static double
+tree_zlines(const char *fn, off_t sz)
+{
+/* estimate the line count of compressed file FN of size SZ from the
+ * lines that decompressing its first 64kB yields, return a negative
+ * value if FN isn't compressed */
+#if defined HAVE_ZLIB_H || defined HAVE_ZSTD_H
+	static char pfx[65536U];
+	char b[4096U];
+	size_t npfx = 0U, nl = 0U;
+	ssize_t nrd;
+	int codec;
+	int fd;
 
-		switch (state) {
-		case EVAL:
-			if (!nheader) {
-				goto fill;
-			}
-			/* otherwise let HEAD state decide */
-			state = HEAD;
-		case HEAD:
-			for (const char *x;
-			     (x = memchr(buf + ibuf, '\n', nbuf - ibuf));) {
-				const size_t o = ibuf;
+	if (UNLIKELY((fd = open(fn, O_RDONLY)) < 0)) {
+		return -1;
+	}
+	for (; npfx < sizeof(pfx) &&
+		     (nrd = read(fd, pfx + npfx, sizeof(pfx) - npfx)) > 0;
+	     npfx += nrd);
+	/* the decoder is to see the prefix and nothing else */
+	if (!npfx || lseek(fd, 0, SEEK_END) < 0 ||
+	    (codec = dec_magic((const unsigned char*)pfx,
+			       npfx)) == CODEC_NONE ||
+	    UNLIKELY(dec_start(codec, fd, pfx, npfx) < 0)) {
+		close(fd);
+		return -1;
+	}
+	while ((nrd = read_dq(fd, b, sizeof(b))) > 0) {
+		for (const char *p = b, *const ep = b + nrd;
+		     (p = memchr(p, *dlm, ep - p)); p++, nl++);
+	}
+	dec_stop();
+	close(fd);
+	/* a prefix short of the whole file counts as truncated */
+	return (double)nl * (double)sz / (double)npfx;
+#else  /* !HAVE_ZLIB_H && !HAVE_ZSTD_H */
+	(void)fn;
+	(void)sz;
+	return -1;
+#endif	/* HAVE_ZLIB_H || HAVE_ZSTD_H */
+}
 
-				ibuf = ++x - buf;
-				fwrite(buf + o, sizeof(*buf), ibuf - o, stdout);
+static int
+tree_tail(const char *fn, off_t sz)
+{
+/* print the footer of regular file FN of size SZ reading only as much
+ * of its end as needed, return 1 if FN is better off being streamed */
+	size_t *last;
+	char *b = NULL;
+	int rc = 1;
+	int fd;
 
-				if (++nfln >= nheader) {
-					if (UNLIKELY(!nfixed)) {
-						/* that's it */
-						return 0;
-					}
-					/* otherwise the most generic mode */
-					goto fill;
-				}
+	if (recfn != NULL) {
+		/* records can't be told apart from the back */
+		return 1;
+	} else if (UNLIKELY((fd = open(fn, O_RDONLY)) < 0)) {
+		/* let the ordinary sampler report it */
+		return 1;
+	} else if (UNLIKELY((last = malloc((nfooter + 1U) *
+					   sizeof(*last))) == NULL)) {
+		close(fd);
+		return 1;
+	}
+#if defined HAVE_ZLIB_H || defined HAVE_ZSTD_H
+	with (unsigned char pfx[18U]) {
+		const ssize_t npfx = pread(fd, pfx, sizeof(pfx), 0);
+
+		if (npfx > 0 && dec_magic(pfx, npfx) != CODEC_NONE) {
+			goto out;
+		}
+	}
+#endif	/* HAVE_ZLIB_H || HAVE_ZSTD_H */
+	for (size_t z = BUFSIZ;; z *= 2U) {
+		const off_t o = sz > (off_t)z ? sz - (off_t)z : 0;
+		const size_t n = sz - o;
+		const char *p, *q;
+		size_t k = 0U;
+
+		with (char *tmp = realloc(b, n + !n)) {
+			if (UNLIKELY(tmp == NULL)) {
+				goto out;
 			}
-			goto wrap;
+			b = tmp;
+		}
+		if (UNLIKELY(pread(fd, b, n, o) != (ssize_t)n)) {
+			goto out;
+		} else if (!o) {
+			p = b;
+		} else if ((q = recchr(b, n)) != NULL) {
+			/* the first record is most likely partial */
+			p = q + 1U;
+		} else {
+			continue;
+		}
+		/* offsets to the beginnings of the last NFOOTER + 1 records */
+		for (last[k++ % (nfooter + 1U)] = p - b;
+		     (q = recchr(p, b + n - p)) != NULL;
+		     last[k++ % (nfooter + 1U)] = (p = q + 1U) - b);
+		/* the last record might go without delimiter */
+		k -= p == b + n;
+		if (k < nfooter && o) {
+			/* widen the window */
+			continue;
+		}
+		if ((o || k > nfooter) && !(quietp & QUIET_TRAIL)) {
+			wr(ell, nell);
+		}
+		with (size_t beg = last[(k - min_z(k, nfooter)) %
+					(nfooter + 1U)]) {
+			wr(b + beg, n - beg);
+		}
+		rc = 0;
+		break;
+	}
+out:
+	free(b);
+	free(last);
+	close(fd);
+	return rc;
+}
 
-		wrap:
-			if (LIKELY(nbuf < zbuf / 2U)) {
-				/* just read some more */
-				break;
-			} else if (UNLIKELY(!ibuf)) {
-				/* great, try a resize */
-				const size_t nuz = zbuf * 2U;
-				char *tmp = realloc(buf, nuz);
+static int
+sample_tree(char *const *fns, const off_t *szs, size_t nfns)
+{
+/* two-level sampler, the NFIXED budget is allocated across FNS in
+ * proportion to their estimated line count and only files with a
+ * non-zero allocation will be sampled (with the usual reservoir) */
+	const size_t ofixed = nfixed, oheader = nheader, ofooter = nfooter;
+	const long long unsigned int orate = rate;
+	const unsigned int oquietp = quietp;
+	size_t *alloc;
+	uint64_t *cum;
+	double *zl;
+	double avgll = 1;
+	int rc = 0;
 
-				if (UNLIKELY(tmp == NULL)) {
-					return -1;
-				}
-				/* otherwise assign and retry */
-				buf = tmp;
-				zbuf = nuz;
-			} else if (LIKELY(ibuf < nbuf)) {
-				memmove(buf, buf + ibuf, nbuf - ibuf);
-				nbuf -= ibuf;
-				ibuf = 0U;
-			}
-			break;
+	if (UNLIKELY((cum = malloc(nfns * sizeof(*cum))) == NULL)) {
+		return sample_union(fns, nfns);
+	} else if (UNLIKELY((zl = malloc(nfns * sizeof(*zl))) == NULL)) {
+		free(cum);
+		return sample_union(fns, nfns);
+	}
+	for (size_t i = 0U; i < nfns; i++) {
+		if (szs[i] < 0) {
+			/* non-regular file, can't estimate */
+			free(cum);
+			free(zl);
+			return sample_union(fns, nfns);
+		}
+		/* compressed files stay out of the line length estimate */
+		zl[i] = tree_zlines(fns[i], szs[i]);
+		cum[i] = (i ? cum[i - 1U] : 0U) + (zl[i] < 0 ? szs[i] : 0U);
+	}
+	if (cum[nfns - 1U]) {
+		avgll = tree_avgll(fns, cum, nfns);
+	}
+	/* ... and are weighed like plain files of as many lines */
+	for (size_t i = 0U; i < nfns; i++) {
+		const uint64_t w = zl[i] < 0
+			? (uint64_t)szs[i] : (uint64_t)(zl[i] * avgll + 0x1.p-1);
 
-		fill:
-			state = FILL;
-		case FILL:
-			for (const char *x;
-			     (x = memchr(buf + ibuf, '\n', nbuf - ibuf));) {
-				/* keep track of lines */
-				lrsv[nfln - nheader] = ibuf;
-				nfln++;
-				ibuf = ++x - buf;
+		cum[i] = (i ? cum[i - 1U] : 0U) + w;
+	}
+	free(zl);
+	if (!cum[nfns - 1U] ||
+	    (double)cum[nfns - 1U] / avgll < (double)(64U * nfixed)) {
+		/* small enough for the exact sampler */
+		free(cum);
+		return sample_union(fns, nfns);
+	}
+	if (UNLIKELY((alloc = calloc(nfns, sizeof(*alloc))) == NULL)) {
+		free(cum);
+		return sample_union(fns, nfns);
+	}
+	/* hand out the budget line by line, i.e. multinomially */
+	for (size_t k = 0U; k < nfixed; k++) {
+		alloc[tree_find(cum, nfns, runifu64() % cum[nfns - 1U])]++;
+	}
 
-				if (nfln - nheader >= nfixed) {
-					goto beef;
-				}
+	/* the first file gets to print the header, the last one the footer,
+	 * everything in between just contributes to the sample */
+	rate = 0U;
+	for (size_t i = 0U; i < nfns; i++) {
+		const int frstp = i == 0U;
+		const int lastp = i + 1U == nfns;
+		size_t nhave;
+
+		nfixed = alloc[i];
+		nheader = frstp ? oheader : 0U;
+		nfooter = lastp ? ofooter : 0U;
+		quietp = oquietp;
+		quietp |= !frstp ? QUIET_LEAD : 0U;
+		quietp |= !lastp ? QUIET_TRAIL : 0U;
+		if (!nfixed) {
+			/* header or footer only, if at all */
+			if (frstp && nheader) {
+				rc |= sample(fns[i]);
+			} else if (lastp && nfooter &&
+				   tree_tail(fns[i], szs[i]) > 0) {
+				rc |= sample(fns[i]);
 			}
-			goto over;
-
-		beef:
-			state = BEEF;
-			/* take on the reservoir */
-			MEMZCPY(rsv, 0U, zrsv, buf + lrsv[0U], ibuf - lrsv[0U]);
-			lrsv[nfixed] = ibuf;
-			for (size_t i = nfixed + 1U; i > 0; i--) {
-				lrsv[i - 1U] -= lrsv[0U];
+			if (frstp && !(oquietp & QUIET_LEAD)) {
+				/* so there was no ellipsis */
+				wr(ell, nell);
 			}
+			continue;
+		}
+		nrec = SIZE_MAX;
+		rc |= sample(fns[i]);
+		if (nrec == SIZE_MAX || lastp || cum[i] >= cum[nfns - 1U]) {
+			/* can't tell or there's nobody to take over */
+			continue;
+		}
+		nhave = nrec - min_z(nrec, nheader + nfooter);
+		/* the estimate was off, hand the shortfall to the files
+		 * that follow, again in proportion to their size */
+		for (size_t k = nhave; k < nfixed; k++) {
+			const uint64_t x = runifu64() %
+				(cum[nfns - 1U] - cum[i]);
+
+			alloc[tree_find(cum, nfns, cum[i] + x)]++;
+		}
+	}
+	free(alloc);
+	free(cum);
+
+	nfixed = ofixed;
+	nheader = oheader;
+	nfooter = ofooter;
+	rate = orate;
+	quietp = oquietp;
+	return rc;
+}
 
-			nfxd = nfixed;
+#if defined HAVE_STRUCT_IO_URING_SQE_FILE_INDEX
+static int
+sample_slot(size_t s)
+{
+/* sample the file slurped into slot S */
+	int rc;
+
+	if (slots[s].ores < 0 || slots[s].rres < 0) {
+		/* let the ordinary sampler deal with (and report) it */
+		return sample(slots[s].fn);
+	} else if (nrsz) {
+		/* fixed-size records, the ordinary sampler picks them by index */
+		return sample(slots[s].fn);
+	}
+#if defined HAVE_ZLIB_H || defined HAVE_ZSTD_H
+	if (dec_magic((const unsigned char*)slbuf + s * ZSLOT,
+		      slots[s].rres) != CODEC_NONE) {
+		/* the ordinary sampler knows how to decompress */
+		return sample(slots[s].fn);
+	}
+#endif	/* HAVE_ZLIB_H || HAVE_ZSTD_H */
+	slb = slbuf + s * ZSLOT;
+	sln = slots[s].rres;
+	if (UNLIKELY(sln >= ZSLOT)) {
+		/* there's more to this file, read the rest classically */
+		if ((slfd = open(slots[s].fn, O_RDONLY)) < 0) {
+			error("\
+Error: cannot open file `%s'", slots[s].fn);
+			return -1;
+		} else if (lseek(slfd, sln, SEEK_SET) < 0) {
+			error("\
+Error: cannot seek in file `%s'", slots[s].fn);
+			close(slfd);
+			slfd = -1;
+			return -1;
+		}
+	}
+	rd = read_slot;
+	rc = sampler()(-1);
+	rd = read;
+	if (slfd >= 0) {
+		close(slfd);
+		slfd = -1;
+	}
+	return rc;
+}
+#endif	/* HAVE_STRUCT_IO_URING_SQE_FILE_INDEX */
 
-			/* we need one more sample step because the
-			 * condition above that got us here goes one
-			 * step further than it should, lest we print
-			 * the ellipsis when there's exactly
-			 * nheader + nfoooter lines in the buffer */
-		case BEEF:
-			for (const char *x;
-			     (x = memchr(buf + ibuf, '\n', nbuf - ibuf));
-			     ibuf = x - buf + 1U, nfln++) {
-				/* current line length */
-				const size_t y = x - buf + 1U - ibuf;
+static int
+sample_batch(char *const *fns, size_t nfns)
+{
+/* sample lots of (small) FNS each on their own, separated head(1)-style */
+	size_t i = 0U;
+	int rc = 0;
 
-				if (nfln - nheader >= 4U * nfixed) {
-					/* switch to gap sampling */
-					goto bexp;
-				}
+#define SEP(i)								\
+	if (nfns > 1U) {						\
+		if (i) {						\
+			wr("\n", 1U);					\
+		}							\
+		wr("==> ", 4U);						\
+		wr(fns[i], strlen(fns[i]));				\
+		wr(" <==\n", 5U);					\
+	}
 
-				/* keep with probability nfixed / nfln */
-				if (runifu32b(nfln - nheader) >= nfixed) {
-					continue;
-				}
+	if (UNLIKELY((slbuf = malloc(countof(slots) * ZSLOT)) == NULL)) {
+		goto posix;
+	}
+#if defined HAVE_STRUCT_IO_URING_SQE_FILE_INDEX
+	if (uring_init(4U * countof(slots), countof(slots)) < 0) {
+		goto posix;
+	}
+	/* slots are used in two halves, while one half is being sampled
+	 * the next batch is slurped into the other one */
+	for (size_t j = 0U; j < nfns && j < NBATCH; j++) {
+		uring_slurp(j, fns[j]);
+	}
+	for (size_t b = 0U; b < nfns; b += NBATCH) {
+		const size_t h = (b / NBATCH) % 2U * NBATCH;
 
-				if (UNLIKELY(nfxd >= mult * nfixed)) {
-					/* condense lrsv */
-					compactify(lrsv, nfxd, nfixed);
-					nfxd = nfixed;
+		for (size_t j = 0U; b + NBATCH + j < nfns && j < NBATCH; j++) {
+			uring_slurp(NBATCH - h + j, fns[b + NBATCH + j]);
+		}
+		if (UNLIKELY(uring_enter(0U) < 0)) {
+			goto uring_fail;
+		}
+		for (size_t j = 0U; (i = b + j) < nfns && j < NBATCH; j++) {
+			while (slots[h + j].npend) {
+				if (UNLIKELY(uring_enter(1U) < 0)) {
+					goto uring_fail;
 				}
-
-				/* bang this line */
-				MEMZCPY(rsv, lrsv[nfxd], zrsv, buf + ibuf, y);
-				/* and memorise him */
-				lrsv[nfxd + 1U] = lrsv[nfxd] + y;
-				nfxd++;
 			}
-			goto over;
+			SEP(i);
+			rc |= sample_slot(h + j) < 0;
+		}
+	}
+	uring_fini();
+	free(slbuf);
+	return rc ? -1 : 0;
+
+uring_fail:
+	error("\
+Error: io_uring failed, continuing without");
+	if (uring_drain() < 0) {
+		/* reads in flight may still land in SLBUF, leave it be */
+		slbuf = NULL;
+	}
+	uring_fini();
+#endif	/* HAVE_STRUCT_IO_URING_SQE_FILE_INDEX */
+posix:
+	for (; i < nfns; i++) {
+		SEP(i);
+		rc |= sample(fns[i]) < 0;
+	}
+	free(slbuf);
+	return rc ? -1 : 0;
+#undef SEP
+}
 
-		bexp:
-			gap = nfln - nheader +
-				rexp32(nfln - nheader - nfixed, nfln);
-			state = BEXP;
-		case BEXP:
-			for (const char *x;
-			     nfln - nheader < gap &&
-				     (x = memchr(buf + ibuf, '\n', nbuf - ibuf));
-			     ibuf = x - buf + 1U, nfln++);
-			for (const char *x;
-			     nfln - nheader >= gap &&
-				     (x = memchr(buf + ibuf, '\n', nbuf - ibuf));
-				) {
-				/* current line length */
-				const size_t y = x - buf + 1U - ibuf;
+/* names from --files0-from */
+static char *f0b;
 
-				if (UNLIKELY(nfxd >= mult * nfixed)) {
-					/* condense lrsv */
-					compactify(lrsv, nfxd, nfixed);
-					nfxd = nfixed;
-				}
+static char**
+files0(const char *fn, size_t *nfns)
+{
+/* read NUL-terminated file names from FN */
+	char *b = f0b;
+	size_t nb = 0U, zb = 0U;
+	char **fns = NULL;
+	size_t n = 0U;
+	ssize_t nrd;
+	int fd;
 
-				/* bang this line */
-				MEMZCPY(rsv, lrsv[nfxd], zrsv, buf + ibuf, y);
-				/* and memorise him */
-				lrsv[nfxd + 1U] = lrsv[nfxd] + y;
-				nfxd++;
+	if (fn[0U] == '-' && fn[1U] == '\0') {
+		fd = STDIN_FILENO;
+	} else if (UNLIKELY((fd = open(fn, O_RDONLY)) < 0)) {
+		error("\
+Error: cannot open file `%s'", fn);
+		return NULL;
+	}
+	for (;; nb += nrd) {
+		if (nb + 1U >= zb) {
+			const size_t nuz = zb ? zb * 2U : BUFSIZ;
+			char *tmp = realloc(b, nuz);
 
-				ibuf = x - buf + 1U;
-				nfln++;
-				goto bexp;
+			if (UNLIKELY(tmp == NULL)) {
+				goto out;
 			}
-			goto over;
-
-		over:
-			/* beef buffer overrun */
-			if (LIKELY(nbuf < zbuf / 2U)) {
-				/* we'll risk reading some more */
-				break;
-			} else if (UNLIKELY(!ibuf || nfln - nheader <= nfixed)) {
-				/* resize and retry */
-				const size_t nuz = zbuf * 2U;
-				char *tmp = realloc(buf, nuz);
-
-				if (UNLIKELY(tmp == NULL)) {
-					return -1;
-				}
-				/* otherwise assign and retry */
-				buf = tmp;
-				zbuf = nuz;
+			f0b = b = tmp;
+			zb = nuz;
+		}
+		if ((nrd = read(fd, b + nb, zb - nb - 1U)) < 0) {
+			error("\
+Error: cannot read file `%s'", fn);
+			goto out;
+		} else if (!nrd) {
+			break;
+		}
+	}
+	/* terminate the last one */
+	b[nb] = '\0';
+
+	for (size_t i = 0U, z = 0U; i < nb; i += strlen(b + i) + 1U) {
+		if (!b[i]) {
+			/* skip empty names */
+			continue;
+		} else if (n >= z) {
+			const size_t nuz = z ? z * 2U : 64U;
+			char **tmp = realloc(fns, nuz * sizeof(*fns));
+
+			if (UNLIKELY(tmp == NULL)) {
 				break;
 			}
-			memmove(buf, buf + ibuf, nbuf - ibuf);
-			nbuf -= ibuf;
-			ibuf -= ibuf;
-			break;
+			fns = tmp;
+			z = nuz;
 		}
+		fns[n++] = b + i;
 	}
-	if (nfln > nheader + nfixed) {
-		/* compactify to obtain the final result */
-		compactify(lrsv, nfxd, nfixed);
+out:
+	if (fd > STDIN_FILENO) {
+		close(fd);
+	}
+	*nfns = n;
+	return fns;
+}
+
+
+/* file lists, for -R */
+static char **flfn;
+static off_t *flsz;
+static size_t nfl;
+static size_t zfl;
+static int flrc;
+/* length of an operand walked as OPERAND/. so the /. can go again */
+static size_t flsl;
+
+static int
+fl_add(const char *fn, off_t sz)
+{
+	if (UNLIKELY(nfl >= zfl)) {
+		const size_t nuz = zfl ? zfl * 2U : 64U;
+		char **tmpf = realloc(flfn, nuz * sizeof(*flfn));
+		off_t *tmpz;
 
-		if (!quietp) {
-			fwrite("...\n", 1, 4U, stdout);
+		if (UNLIKELY(tmpf == NULL)) {
+			return -1;
 		}
-		fwrite(rsv + lrsv[0U], sizeof(*rsv),
-		       lrsv[nfixed] - lrsv[0U], stdout);
-		if (!quietp) {
-			fwrite("...\n", 1, 4U, stdout);
+		flfn = tmpf;
+		if (UNLIKELY((tmpz = realloc(flsz, nuz * sizeof(*flsz))) == NULL)) {
+			return -1;
 		}
-	} else if (nfln == nheader + nfixed) {
-		/* we ran 0 steps through beef */
-		const size_t z = lrsv[nfixed];
-
-		fwrite(rsv + lrsv[0U], sizeof(*rsv), z - lrsv[0U], stdout);
-	} else if (ibuf > lrsv[0U]) {
-		fwrite(buf + lrsv[0U], sizeof(*buf), ibuf - lrsv[0U], stdout);
+		flsz = tmpz;
+		zfl = nuz;
 	}
-	if (lrsv != _lrsv) {
-		free(lrsv);
+	if (UNLIKELY((flfn[nfl] = strdup(fn)) == NULL)) {
+		return -1;
+	} else if (flsl) {
+		char *const p = flfn[nfl] + flsl;
+
+		memmove(p, p + 2U, strlen(p + 2U) + 1U);
 	}
+	flsz[nfl++] = sz;
 	return 0;
 }
 
 static int
-sample(const char *fn)
+fl_cmp(const void *a, const void *b)
 {
-	int(*sample)(int) = sample_gen;
-	struct stat st;
-	int rc = 0;
-	int fd;
+	const char *const *fa = a;
+	const char *const *fb = b;
+	return strcmp(*fa, *fb);
+}
 
-	if (nfixed) {
-		switch (nfooter) {
-		case 0U:
-			sample = sample_rsv_0f;
-			break;
-		case 1U:
-			sample = sample_rsv_1f;
+static int
+fl_walk1(const char *fn, const struct stat *st, int typ, struct FTW *ftw)
+{
+	struct stat lst;
+
+	switch (typ) {
+	case FTW_F:
+		if (S_ISREG(st->st_mode)) {
+			return fl_add(fn, st->st_size);
+		} else if (!ftw->level) {
+			/* explicitly mentioned, so take it */
+			return fl_add(fn, -1);
+		}
+		break;
+	case FTW_SL:
+		if (ftw->level) {
+			/* links below the operands aren't followed */
 			break;
-		default:
-			sample = sample_rsv;
+		} else if (UNLIKELY(stat(fn, &lst) < 0)) {
+			error("\
+Error: cannot access `%s'", fn);
+			flrc = -1;
 			break;
 		}
-	} else if (!rate && !nfooter && !nheader) {
-		sample = sample_0;
+		/* explicitly mentioned, so follow it */
+		return fl_add(fn, S_ISREG(lst.st_mode) ? lst.st_size : -1);
+	case FTW_DNR:
+	case FTW_NS:
+		error("\
+Error: cannot access `%s'", fn);
+		flrc = -1;
+		break;
+	default:
+		break;
 	}
+	return 0;
+}
 
-	if (fn == NULL || fn[0U] == '-' && fn[1U] == '\0') {
-		/* stdin ... *sigh* */
-		fd = STDIN_FILENO;
-		return sample(fd);
-	} else if (UNLIKELY((fd = open(fn, O_RDONLY)) < 0)) {
+static int
+fl_walk(const char *fn)
+{
+	const size_t beg = nfl;
+	struct stat st;
+
+	if (fn[0U] == '-' && fn[1U] == '\0') {
+		/* stdin can't be walked */
+		return fl_add(fn, -1);
+	} else if (!lstat(fn, &st) && S_ISLNK(st.st_mode) &&
+		   !stat(fn, &st) && S_ISDIR(st.st_mode)) {
+		/* a link to a directory, walk the directory behind it */
+		const size_t z = strlen(fn);
+		char *dn = malloc(z + 3U);
+		int rc;
+
+		if (UNLIKELY(dn == NULL)) {
+			return -1;
+		}
+		memcpy(dn, fn, z);
+		memcpy(dn + z, "/.", 3U);
+		flsl = z;
+		rc = nftw(dn, fl_walk1, 16, FTW_PHYS);
+		flsl = 0U;
+		free(dn);
+		if (rc < 0) {
+			error("\
+Error: cannot walk `%s'", fn);
+			return -1;
+		}
+	} else if (nftw(fn, fl_walk1, 16, FTW_PHYS) < 0) {
 		error("\
-Error: cannot open file `%s'", fn);
+Error: cannot walk `%s'", fn);
 		return -1;
-	} else if (UNLIKELY(fstat(fd, &st) < 0)) {
-		error("\
-Error: cannot stat file `%s'", fn);
-		rc = -1;
-	} else if (!S_ISREG(st.st_mode)) {
-		/* fgetln/getline */
-		rc = sample(fd);
-	} else {
-		rc = sample(fd);
 	}
-
-	close(fd);
-	return rc;
+	/* the order of readdir() is arbitrary, sort this level at least
+	 * but the lengths need moving too, so sort an index first */
+	with (size_t n = nfl - beg) {
+		struct {
+			char *fn;
+			off_t sz;
+		} *tmp = malloc(n * sizeof(*tmp));
+
+		if (UNLIKELY(tmp == NULL)) {
+			break;
+		}
+		for (size_t i = 0U; i < n; i++) {
+			tmp[i].fn = flfn[beg + i];
+			tmp[i].sz = flsz[beg + i];
+		}
+		qsort(tmp, n, sizeof(*tmp), fl_cmp);
+		for (size_t i = 0U; i < n; i++) {
+			flfn[beg + i] = tmp[i].fn;
+			flsz[beg + i] = tmp[i].sz;
+		}
+		free(tmp);
+	}
+	return flrc;
+}
+
+static double
+strtorate(const char *s, char **on)
+{
+/* read a sample rate off S, values between 0 and 1, or if suffixed
+ * with %, are taken literally, values >1 mean 1 in X, return -1 on
+ * error and point ON past what's been read */
+	double x = strtod(s, on);
+
+	if (x < 0) {
+		errno = 0, error("\
+Error: sample rate must be non-negative");
+		return -1;
+	} else if (**on == '%' && x > 100) {
+		errno = 0, error("\
+Error: sample rate in percent must be <=100");
+		return -1;
+	} else if (**on == '%') {
+		x /= 100;
+		++*on;
+	}
+	return x > 1 ? 1 / x : x;
+}
+
+static size_t
+unescape(char *s)
+{
+/* turn C escapes in S into bytes, in place, return the new length */
+	static const char esc[] = "\\\\a\ab\bf\fn\nr\rt\tv\v";
+	const char *p = s;
+	char *t = s;
+
+	for (; *p; p++, t++) {
+		const char *e;
+		unsigned int x = 0U;
+		size_t i;
+
+		if (*p != '\\' || !p[1U]) {
+			*t = *p;
+		} else if (p[1U] == 'x' && isxdigit((unsigned char)p[2U])) {
+			for (i = 2U; i < 4U && isxdigit((unsigned char)p[i]); i++) {
+				x = x * 16U + (isdigit((unsigned char)p[i])
+					       ? p[i] - '0'
+					       : (p[i] | 0x20) - 'a' + 10);
+			}
+			*t = (char)x;
+			p += i - 1U;
+		} else if (p[1U] >= '0' && p[1U] <= '7') {
+			for (i = 1U; i < 4U && p[i] >= '0' && p[i] <= '7'; i++) {
+				x = x * 8U + (p[i] - '0');
+			}
+			*t = (char)x;
+			p += i - 1U;
+		} else if ((e = strchr(esc, p[1U])) && !((e - esc) % 2)) {
+			*t = e[1U];
+			p++;
+		} else {
+			/* take unknown escapes literally */
+			*t = *++p;
+		}
+	}
+	return t - s;
 }
 
 
@@ -1385,13 +6216,25 @@ int
 main(int argc, char *argv[])
 {
 	yuck_t argi[1U];
+	char **args;
+	size_t nargs;
+	const char *ofn = NULL;
 	int rc = 0;
 
 	if (yuck_parse(argi, argc, argv)) {
 		rc = 1;
 		goto out;
 	}
-
+	args = argi->args;
+	nargs = argi->nargs;
+
+	if (argi->rest_arg || argi->split_arg || argi->shard_arg ||
+	    argi->shuffle_flag) {
+		/* partitions have no header or footer unless asked for,
+		 * lest those lines end up in more than one output,
+		 * shuffles neither lest lines stay put */
+		nheader = nfooter = 0U;
+	}
 	if (argi->girdle_arg) {
 		nheader = nfooter = strtoul(argi->girdle_arg, NULL, 0);
 	}
@@ -1402,10 +6245,187 @@ main(int argc, char *argv[])
 		nfooter = strtoul(argi->footer_arg, NULL, 0);
 	}
 	/* capture -q|--quiet */
-	quietp = argi->quiet_flag;
+	quietp = argi->quiet_flag ? QUIET_LEAD | QUIET_TRAIL : 0U;
+
+	if (argi->zero_terminated_flag && argi->delimiter_arg) {
+		errno = 0, error("\
+Error: -z and --delimiter cannot be combined");
+		rc = 1;
+		goto out;
+	} else if (argi->zero_terminated_flag) {
+		dlm = "";
+		/* the terminating NUL is part of it */
+		ell = "...";
+	} else if (argi->delimiter_arg) {
+		char *e;
+
+		if (!(ndlm = unescape(argi->delimiter_arg))) {
+			errno = 0, error("\
+Error: delimiter must not be empty");
+			rc = 1;
+			goto out;
+		} else if (UNLIKELY((e = malloc(3U + ndlm)) == NULL)) {
+			rc = 1;
+			goto out;
+		}
+		memcpy(e, "...", 3U);
+		memcpy(e + 3U, argi->delimiter_arg, ndlm);
+		dlm = argi->delimiter_arg;
+		ell = e;
+		recfn = ndlm > 1U ? recchr_mb : NULL;
+	}
+	nell = 3U + ndlm;
+	if (argi->csv_flag && ndlm > 1U) {
+		errno = 0, error("\
+Error: --csv needs a single-byte delimiter");
+		rc = 1;
+		goto out;
+	} else if (argi->csv_flag) {
+		recfn = recchr_csv;
+	}
+	if (argi->field_separator_arg &&
+	    unescape(argi->field_separator_arg) != 1U) {
+		errno = 0, error("\
+Error: field separator must be a single byte");
+		rc = 1;
+		goto out;
+	} else if (argi->field_separator_arg) {
+		fs = *argi->field_separator_arg;
+	}
+	if (argi->json_array_flag &&
+	    (recfn != NULL || argi->delimiter_arg ||
+	     argi->zero_terminated_flag || argi->record_size_arg ||
+	     argi->length_prefix_arg || argi->record_start_arg ||
+	     argi->record_start_regex_arg)) {
+		errno = 0, error("\
+Error: --json-array cannot be combined with other record options");
+		rc = 1;
+		goto out;
+	}
+	jap = argi->json_array_flag;
+	/* group lines to records */
+	lnfn = recfn != NULL ? recfn : recchr_1;
+	if (argi->record_size_arg &&
+	    (recfn != NULL || argi->delimiter_arg ||
+	     argi->lines_per_record_arg || argi->record_start_arg ||
+	     argi->record_start_regex_arg || argi->zero_terminated_flag)) {
+		errno = 0, error("\
+Error: --record-size cannot be combined with other record options");
+		rc = 1;
+		goto out;
+	} else if (argi->record_size_arg) {
+		char *on;
+
+		nrsz = strtoul(argi->record_size_arg, &on, 0);
+		if (!nrsz || *on) {
+			errno = 0, error("\
+Error: parameter to --record-size must be positive");
+			rc = 1;
+			goto out;
+		}
+		recfn = recchr_fix;
+		/* ellipses have no place in binary output */
+		quietp = QUIET_LEAD | QUIET_TRAIL;
+	}
+	if (argi->length_prefix_arg &&
+	    (recfn != NULL || argi->delimiter_arg ||
+	     argi->record_start_arg || argi->record_start_regex_arg ||
+	     argi->zero_terminated_flag)) {
+		errno = 0, error("\
+Error: --length-prefix cannot be combined with other record options");
+		rc = 1;
+		goto out;
+	} else if (argi->length_prefix_arg) {
+		if (!strcmp(argi->length_prefix_arg, "varint")) {
+			lpfx = LPFX_VARINT;
+		} else if (!strcmp(argi->length_prefix_arg, "u32")) {
+			lpfx = LPFX_U32;
+		} else {
+			errno = 0, error("\
+Error: length prefix must be one of varint or u32");
+			rc = 1;
+			goto out;
+		}
+		/* frames can still be grouped by --lines-per-record */
+		lnfn = recfn = recchr_len;
+		quietp = QUIET_LEAD | QUIET_TRAIL;
+	}
+	if (argi->lines_per_record_arg &&
+	    (argi->record_start_arg || argi->record_start_regex_arg)) {
+		errno = 0, error("\
+Error: --lines-per-record and --record-start cannot be combined");
+		rc = 1;
+		goto out;
+	} else if (argi->record_start_arg && argi->record_start_regex_arg) {
+		errno = 0, error("\
+Error: --record-start and --record-start-regex cannot be combined");
+		rc = 1;
+		goto out;
+	} else if (argi->lines_per_record_arg) {
+		char *on;
+
+		nlpr = strtoul(argi->lines_per_record_arg, &on, 0);
+		if (!nlpr || *on) {
+			errno = 0, error("\
+Error: parameter to --lines-per-record must be positive");
+			rc = 1;
+			goto out;
+		}
+		recfn = nlpr > 1U ? recchr_k : recfn;
+	} else if (argi->record_start_arg) {
+		if (argi->csv_flag) {
+			errno = 0, error("\
+Error: --csv and --record-start cannot be combined");
+			rc = 1;
+			goto out;
+		} else if (!(nrs = unescape(argi->record_start_arg))) {
+			errno = 0, error("\
+Error: record start prefix must not be empty");
+			rc = 1;
+			goto out;
+		}
+		rs = argi->record_start_arg;
+		recfn = recchr_rs;
+	} else if (argi->record_start_regex_arg) {
+		const char *re = argi->record_start_regex_arg;
+		const size_t nre = strlen(re);
+		char *lit;
+		int rxc;
+
+		if (argi->csv_flag) {
+			errno = 0, error("\
+Error: --csv and --record-start cannot be combined");
+			rc = 1;
+			goto out;
+		} else if (UNLIKELY((lit = malloc(nre + 4U)) == NULL)) {
+			rc = 1;
+			goto out;
+		}
+		/* matches must start at the beginning of the line */
+		memcpy(lit, "^(", 2U);
+		memcpy(lit + 2U, re, nre);
+		memcpy(lit + 2U + nre, ")", 2U);
+		if ((rxc = regcomp(&rsrx, lit, REG_EXTENDED | REG_NOSUB))) {
+			char msg[256U];
+
+			regerror(rxc, &rsrx, msg, sizeof(msg));
+			errno = 0, error("\
+Error: cannot compile record start regex `%s': %s", re, msg);
+			free(lit);
+			rc = 1;
+			goto out;
+		}
+		nrs = rx_lit(lit, re);
+		rssetp = !nrs && rx_set(rsset, re);
+		rs = lit;
+		rsrxp = 1;
+		recfn = recchr_rs;
+	}
 
 	/* treat ttys specially */
-	if (isatty(STDOUT_FILENO) && !argi->rate_arg) {
+	if (isatty(STDOUT_FILENO) && !argi->rate_arg && !argi->output_nargs &&
+	    !argi->hash_sample_arg && !argi->prob_field_arg &&
+	    !argi->bootstrap_arg && !argi->rest_arg && !argi->shuffle_flag) {
 #if defined TIOCGWINSZ
 		with (struct winsize ws) {
 			if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) < 0) {
@@ -1422,30 +6442,334 @@ main(int argc, char *argv[])
 #endif	/* TIOCGWINSZ */
 	}
 
-	if (argi->rate_arg) {
+	if (argi->rate_arg && argi->hash_sample_arg) {
+		errno = 0, error("\
+Error: --rate and --hash-sample cannot be combined");
+		rc = 1;
+		goto out;
+	} else if (argi->prob_field_arg &&
+		   (argi->rate_arg || argi->hash_sample_arg ||
+		    argi->fixed_arg || argi->paired_flag)) {
+		errno = 0, error("\
+Error: --prob-field cannot be combined with -r, -n, --hash-sample \
+or --paired");
+		rc = 1;
+		goto out;
+	} else if (argi->prob_field_arg) {
 		char *on;
-		double x = strtod(argi->rate_arg, &on);
 
-		if (x < 0.) {
+		if (!(pfld = strtoul(argi->prob_field_arg, &on, 10)) ||
+		    *on && *on != ',') {
 			errno = 0, error("\
-Error: sample rate must be non-negative");
+Error: field to --prob-field must be positive");
 			rc = 1;
 			goto out;
-		} else if (*on == '%' && x > 100.) {
+		} else if (*on && (!((pscl = strtod(on + 1U, &on)) >= 0) ||
+				   *on)) {
 			errno = 0, error("\
-Error: sample rate in percent must be <=100");
+Error: scale factor to --prob-field must be non-negative");
 			rc = 1;
 			goto out;
-		} else if (*on == '%') {
-			x /= 100.;
 		}
+		/* any rate that sends sample_gen() the CAKE way */
+		rate = UINT32_MAX;
+		pickfn = pick_prob;
+	} else if (argi->rate_arg) {
+		char *on;
+		double x;
 
-		if (x > 1.) {
-			x = 1. / x;
+		if ((x = strtorate(argi->rate_arg, &on)) < 0) {
+			rc = 1;
+			goto out;
 		}
+		rate = (long long unsigned int)(0x1.p32 * x);
+	} else if (argi->hash_sample_arg) {
+		char *on;
+		double x;
 
+		if ((x = strtorate(argi->hash_sample_arg, &on)) < 0) {
+			rc = 1;
+			goto out;
+		} else if (*on == ',' &&
+			   (!(hfld = strtoul(on + 1U, &on, 10)) || *on)) {
+			errno = 0, error("\
+Error: field to --hash-sample must be positive");
+			rc = 1;
+			goto out;
+		} else if (*on && *on != ',') {
+			errno = 0, error("\
+Error: cannot read rate in --hash-sample");
+			rc = 1;
+			goto out;
+		} else if (argi->fixed_arg || argi->paired_flag) {
+			errno = 0, error("\
+Error: --hash-sample cannot be combined with -n or --paired");
+			rc = 1;
+			goto out;
+		}
 		rate = (long long unsigned int)(0x1.p32 * x);
+		hthr = (uint64_t)rate << 32U;
+		pickfn = pick_hash;
+	}
+	if (argi->stratify_arg) {
+		char *on;
+
+		if (!(sfld = strtoul(argi->stratify_arg, &on, 10)) || *on) {
+			errno = 0, error("\
+Error: field to --stratify must be positive");
+			rc = 1;
+			goto out;
+		} else if (!argi->fixed_arg || argi->hash_sample_arg ||
+			   argi->paired_flag || argi->recursive_flag) {
+			errno = 0, error("\
+Error: --stratify needs -n and no --hash-sample, --paired or -R");
+			rc = 1;
+			goto out;
+		}
+		kops = &kops_strat;
+	}
+	if (argi->weight_arg) {
+		char *on;
+
+		if (!(wfld = strtoul(argi->weight_arg, &on, 10)) || *on) {
+			errno = 0, error("\
+Error: field to --weight must be positive");
+			rc = 1;
+			goto out;
+		} else if (!argi->fixed_arg || kops != NULL ||
+			   argi->hash_sample_arg ||
+			   argi->paired_flag || argi->recursive_flag) {
+			errno = 0, error("\
+Error: --weight needs -n and no --stratify, --hash-sample, --paired or -R");
+			rc = 1;
+			goto out;
+		}
+		kops = &kops_wgt;
+	}
+	if (argi->distinct_arg) {
+		char *on;
+
+		if (argi->distinct_arg == YUCK_OPTARG_NONE) {
+			/* whole records then */
+			;
+		} else if (!(dfld = strtoul(argi->distinct_arg, &on, 10)) ||
+			   *on) {
+			errno = 0, error("\
+Error: field to --distinct must be positive");
+			rc = 1;
+			goto out;
+		}
+		if (!argi->fixed_arg || kops != NULL ||
+		    argi->hash_sample_arg || argi->prob_field_arg ||
+		    argi->paired_flag || argi->recursive_flag) {
+			errno = 0, error("\
+Error: --distinct needs -n and no other sampling mode, --paired or -R");
+			rc = 1;
+			goto out;
+		}
+		kops = &kops_dst;
+	}
+	if (argi->split_arg) {
+		double sum = 0;
+		char *on;
+
+		for (const char *p = argi->split_arg; p != NULL;
+		     p = *on == ',' ? on + 1U : NULL) {
+			const double x = strtod(p, &on);
+
+			if (!(x >= 0) || *on && *on != ',') {
+				errno = 0, error("\
+Error: shares to --split must be non-negative numbers");
+				rc = 1;
+				goto out;
+			}
+			sum += x;
+			nreps++;
+		}
+		if (!(sum > 0) || nreps < 2U) {
+			errno = 0, error("\
+Error: --split needs at least two shares, not all of them 0");
+			rc = 1;
+			goto out;
+		} else if (!argi->output_nargs || argi->fixed_arg ||
+			   argi->rate_arg || argi->bootstrap_arg ||
+			   argi->replicates_arg || argi->rest_arg ||
+			   argi->shard_arg ||
+			   kops != NULL || argi->hash_sample_arg ||
+			   argi->prob_field_arg ||
+			   argi->paired_flag || argi->recursive_flag) {
+			errno = 0, error("\
+Error: --split needs -o and no other sampling mode, --paired or -R");
+			rc = 1;
+			goto out;
+		} else if (UNLIKELY((scum = malloc(nreps *
+						   sizeof(*scum))) == NULL)) {
+			rc = 1;
+			goto out;
+		}
+		with (double cum = 0) {
+			const char *p = argi->split_arg;
+
+			for (size_t i = 0U; i < nreps; i++, p = on + 1U) {
+				cum += strtod(p, &on);
+				scum[i] = (uint64_t)(cum / sum * 0x1.p32);
+			}
+		}
+		/* ellipses have no place in a partition */
+		quietp = QUIET_LEAD | QUIET_TRAIL;
+	} else if (argi->shard_arg) {
+		char *on;
+
+		if (!(nreps = strtoul(argi->shard_arg, &on, 10)) || *on ||
+		    nreps > UINT32_MAX) {
+			errno = 0, error("\
+Error: number of shards must be positive");
+			rc = 1;
+			goto out;
+		} else if (!argi->output_nargs || argi->fixed_arg ||
+			   argi->rate_arg || argi->bootstrap_arg ||
+			   argi->replicates_arg || argi->rest_arg ||
+			   kops != NULL || argi->hash_sample_arg ||
+			   argi->prob_field_arg ||
+			   argi->paired_flag || argi->recursive_flag) {
+			errno = 0, error("\
+Error: --shard needs -o and no other sampling mode, --paired or -R");
+			rc = 1;
+			goto out;
+		}
+		shardp = 1;
+		/* ellipses have no place in a partition */
+		quietp = QUIET_LEAD | QUIET_TRAIL;
+	} else if (argi->bootstrap_arg) {
+		char *on;
+
+		if (argi->bootstrap_arg == YUCK_OPTARG_NONE) {
+			nreps = 1U;
+		} else if (!(nreps = strtoul(argi->bootstrap_arg, &on, 10)) ||
+			   *on) {
+			errno = 0, error("\
+Error: number of bootstrap replicates must be positive");
+			rc = 1;
+			goto out;
+		}
+		if (nreps > 1U && !argi->output_nargs ||
+		    argi->replicates_arg || argi->fixed_arg ||
+		    argi->rate_arg || kops != NULL ||
+		    argi->hash_sample_arg || argi->prob_field_arg ||
+		    argi->paired_flag || argi->recursive_flag) {
+			errno = 0, error("\
+Error: --bootstrap needs -o for more than one replicate \
+and no other sampling mode, --paired or -R");
+			rc = 1;
+			goto out;
+		}
+		bootp = 1;
+	} else if (argi->replicates_arg) {
+		char *on;
+
+		if (!(nreps = strtoul(argi->replicates_arg, &on, 10)) || *on) {
+			errno = 0, error("\
+Error: number of replicates must be positive");
+			rc = 1;
+			goto out;
+		} else if (!argi->output_nargs || kops != NULL ||
+			   argi->hash_sample_arg || argi->prob_field_arg ||
+			   argi->paired_flag || argi->recursive_flag) {
+			errno = 0, error("\
+Error: --replicates needs -o and no other sampling mode, --paired or -R");
+			rc = 1;
+			goto out;
+		}
+	}
+	if (argi->shard_key_arg) {
+		char *on;
+
+		if (argi->shard_key_arg == YUCK_OPTARG_NONE) {
+			/* whole records then */
+			;
+		} else if (!(shfld = strtoul(argi->shard_key_arg, &on, 10)) ||
+			   *on) {
+			errno = 0, error("\
+Error: field to --shard-key must be positive");
+			rc = 1;
+			goto out;
+		}
+		if (!shardp) {
+			errno = 0, error("\
+Error: --shard-key needs --shard");
+			rc = 1;
+			goto out;
+		}
+		shkeyp = 1;
+	}
+	if (argi->shuffle_flag) {
+		if (argi->fixed_arg || argi->rate_arg || nreps ||
+		    kops != NULL || argi->hash_sample_arg ||
+		    argi->prob_field_arg || argi->rest_arg ||
+		    argi->paired_flag || argi->union_flag) {
+			errno = 0, error("\
+Error: --shuffle cannot be combined with other sampling modes, \
+--paired or -u");
+			rc = 1;
+			goto out;
+		}
+		shufp = 1;
+		/* nothing is left out */
+		quietp = QUIET_LEAD | QUIET_TRAIL;
+	}
+	if (argi->unordered_flag && (!argi->fixed_arg || nreps)) {
+		errno = 0, error("\
+Error: --unordered needs -n and no --replicates");
+		rc = 1;
+		goto out;
+	} else if (argi->unordered_flag) {
+		unordp = 1;
+	}
+	if (argi->buffer_size_arg) {
+		char *on;
+		unsigned long long int x;
+		unsigned int sh = 0U;
+
+		errno = 0;
+		x = strtoull(argi->buffer_size_arg, &on, 10);
+		switch (*on) {
+		case 'T':
+			sh += 10U;
+			/* fallthrough */
+		case 'G':
+			sh += 10U;
+			/* fallthrough */
+		case 'M':
+			sh += 10U;
+			/* fallthrough */
+		case 'k':
+		case 'K':
+			sh += 10U;
+			on++;
+			break;
+		default:
+			break;
+		}
+		if (!x || *on || *argi->buffer_size_arg == '-') {
+			errno = 0, error("\
+Error: buffer size must be positive, suffixes k, M, G or T");
+			rc = 1;
+			goto out;
+		} else if (errno == ERANGE || x > (SIZE_MAX >> sh)) {
+			errno = 0, error("\
+Error: buffer size `%s' is too large", argi->buffer_size_arg);
+			rc = 1;
+			goto out;
+		}
+		shmem = (size_t)x << sh;
 	}
+	if (argi->temporary_directory_arg) {
+		tmpdir = argi->temporary_directory_arg;
+	} else if (getenv("TMPDIR") != NULL && *getenv("TMPDIR")) {
+		tmpdir = getenv("TMPDIR");
+	}
+	/* enough buckets to fan out a lot, few enough to stay in budget */
+	for (shnb = 2U; shnb < 256U && 8U * shnb * SHBUF <= shmem; shnb *= 2U);
 	if (argi->fixed_arg) {
 		char *on;
 		nfixed = strtoul(argi->fixed_arg, &on, 0);
@@ -1459,6 +6783,41 @@ Error: parameter to --fixed must be positive");
 			goto out;
 		}
 	}
+	if (argi->rest_arg &&
+	    (argi->fixed_arg || nfixed || kops != NULL || nreps ||
+	     argi->paired_flag)) {
+		errno = 0, error("\
+Error: --rest works with -r, --hash-sample or --prob-field only");
+		rc = 1;
+		goto out;
+	} else if (argi->rest_arg) {
+		restp = 1;
+		/* every line goes to exactly one of the outputs */
+		quietp = QUIET_LEAD | QUIET_TRAIL;
+		if (!rate) {
+			rate = UINT32_MAX;
+			pickfn = pick_none;
+		}
+	}
+	if (kops == &kops_dst && nfixed) {
+		for (zdset = 16U; zdset < 2U * nfixed; zdset *= 2U);
+		if (UNLIKELY((dkey = malloc(nfixed * sizeof(*dkey))) == NULL) ||
+		    UNLIKELY((drec = calloc(nfixed, sizeof(*drec))) == NULL) ||
+		    UNLIKELY((dset = calloc(zdset, sizeof(*dset))) == NULL)) {
+			error("\
+Error: cannot allocate distinct sketch");
+			rc = 1;
+			goto out;
+		}
+	}
+	if (kops == &kops_wgt && nfixed &&
+	    (UNLIKELY((wkey = malloc(nfixed * sizeof(*wkey))) == NULL) ||
+	     UNLIKELY((wrec = calloc(nfixed, sizeof(*wrec))) == NULL))) {
+		error("\
+Error: cannot allocate weighted reservoir");
+		rc = 1;
+		goto out;
+	}
 
 	with (uint64_t seed = 0U) {
 		if (argi->seed_arg) {
@@ -1477,6 +6836,28 @@ Error: seeds must be positive integers");
 		}
 		/* initialise randomness */
 		pcg32_srandom(seed);
+		/* and the hash of --distinct */
+		dsalt = mum64(seed ^ 0xa0761d6478bd642fULL,
+			      0xe7037ed1a0b428dbULL);
+		/* and every replicate's random state */
+		if (nreps &&
+		    UNLIKELY((rg32 = malloc(nreps * sizeof(*rg32))) == NULL ||
+			     (rnx = malloc(nreps * sizeof(*rnx))) == NULL)) {
+			rc = 1;
+			goto out;
+		}
+		for (size_t i = 0U; i < nreps; i++) {
+			rg32[i] = runifu64();
+		}
+		if (nreps && nfixed &&
+		    UNLIKELY((rw = malloc(nreps * sizeof(*rw))) == NULL ||
+			     (rrec = calloc(nreps * nfixed,
+					    sizeof(*rrec))) == NULL)) {
+			error("\
+Error: cannot allocate reservoirs for the replicates");
+			rc = 1;
+			goto out;
+		}
 
 		if (argi->dashs_flag) {
 			fprintf(stderr, "0x%016llx\n", seed);
@@ -1494,9 +6875,107 @@ Error: seeds must be positive integers");
 		}
 		stklmt = lmt.rlim_cur / sizeof(stklmt) / 2U;
 	}
+#if defined HAVE_ZLIB_H || defined HAVE_ZSTD_H
+	/* number of threads for parallel decoding */
+	with (long int ncpu = sysconf(_SC_NPROCESSORS_ONLN)) {
+		nthr = ncpu > 0 ? min_z(ncpu, 16U) : 1U;
+	}
+#endif	/* HAVE_ZLIB_H || HAVE_ZSTD_H */
+
+	if (argi->files0_from_arg && argi->nargs) {
+		errno = 0, error("\
+Error: file operands cannot be combined with --files0-from");
+		rc = 1;
+		goto out;
+	} else if (argi->files0_from_arg) {
+		args = files0(argi->files0_from_arg, &nargs);
+		if (args == NULL && !nargs) {
+			rc = 1;
+		}
+	} else if (!nargs) {
+		static char *dflt[] = {"-"};
+		static char *dot[] = {"."};
+
+		args = argi->recursive_flag ? dot : dflt;
+		nargs = 1U;
+	}
+
+	if (argi->paired_flag && (argi->recursive_flag ||
+				  argi->union_flag || argi->files0_from_arg)) {
+		errno = 0, error("\
+Error: --paired cannot be combined with -R, --union or --files0-from");
+		rc = 1;
+		goto fin;
+	} else if (argi->paired_flag && argi->output_nargs &&
+		   argi->output_nargs != nargs) {
+		errno = 0, error("\
+Error: --paired needs as many output files as input files");
+		rc = 1;
+		goto fin;
+	} else if (nreps > 1U || nreps && !bootp) {
+		if (fo_open(argi->output_args, argi->output_nargs, nreps) < 0) {
+			rc = 1;
+			goto fin;
+		}
+	} else if (!argi->paired_flag && argi->output_nargs > 1U) {
+		errno = 0, error("\
+Error: more than one output file given");
+		rc = 1;
+		goto fin;
+	} else if (!argi->paired_flag && argi->output_nargs) {
+		ofn = argi->output_args[0U];
+	}
+
+	if (ofn != NULL && out_open(ofn) < 0) {
+		rc = 1;
+		goto fin;
+	} else if (restp && fo_open(&argi->rest_arg, 1U, 1U) < 0) {
+		rc = 1;
+		goto fin;
+	}
 
-	for (size_t i = 0U; i < argi->nargs + !argi->nargs; i++) {
-		rc |= sample(argi->args[i]) < 0;
+	if (argi->paired_flag) {
+		rc |= sample_paired(args, nargs,
+				    argi->output_args, argi->output_nargs) < 0;
+	} else if (argi->recursive_flag) {
+		for (size_t i = 0U; i < nargs; i++) {
+			rc |= fl_walk(args[i]) < 0;
+		}
+		if (!nfl) {
+			;
+		} else if (nfixed && nfl > 1U) {
+			/* one budget for the whole tree */
+			rc |= sample_tree(flfn, flsz, nfl) < 0;
+		} else if (argi->union_flag && nfl > 1U) {
+			rc |= sample_union(flfn, nfl) < 0;
+		} else for (size_t i = 0U; i < nfl; i++) {
+			rc |= sample(flfn[i]) < 0;
+		}
+		for (size_t i = 0U; i < nfl; i++) {
+			free(flfn[i]);
+		}
+		free(flfn);
+		free(flsz);
+	} else if (argi->union_flag && nargs > 1U) {
+		rc |= sample_union(args, nargs) < 0;
+	} else if (argi->files0_from_arg) {
+		rc |= sample_batch(args, nargs) < 0;
+	} else for (size_t i = 0U; i < nargs; i++) {
+		rc |= sample(args[i]) < 0;
+	}
+	if (ofn != NULL && UNLIKELY(out_close() < 0)) {
+		error("\
+Error: cannot write to `%s'", ofn);
+		rc = 1;
+	} else if (nfo && UNLIKELY(fo_close() < 0)) {
+		error("\
+Error: cannot write output files");
+		rc = 1;
+	}
+fin:
+	if (argi->files0_from_arg) {
+		free(args);
+		free(f0b);
 	}
 
 	if (buf != NULL) {
@@ -1511,8 +6990,21 @@ Error: seeds must be positive integers");
 	if (idir != NULL) {
 		free(idir);
 	}
+#if defined HAVE_ZLIB_H || defined HAVE_ZSTD_H
+	dec_free();
+#endif	/* HAVE_ZLIB_H || HAVE_ZSTD_H */
+	if (argi->delimiter_arg) {
+		free(deconst(ell));
+	}
 
 out:
+	if (rsrxp) {
+		regfree(&rsrx);
+		free(deconst(rs));
+#if !defined REG_STARTEND
+		free(rsl);
+#endif	/* !REG_STARTEND */
+	}
 	yuck_free(argi);
 	return rc;
 }